@@ -0,0 +1,281 @@
+#ifndef SCAFFOLD_COMMUNICATION_ACTIVE_MESSAGE_H_
+#define SCAFFOLD_COMMUNICATION_ACTIVE_MESSAGE_H_
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Active messages: calls to handlers registered on every process, made on
+/// a remote process without it posting matching receives. Arguments go
+/// through the serialization layer (serialize.h), and calls to the same
+/// process are batched into one message once threshold bytes build up (or
+/// on Flush). Calls run when the destination makes progress, either from
+/// explicit Progress() calls or from a polling thread, and may make further
+/// calls. Quiesce() waits (collectively) until every call made anywhere has
+/// run. All methods are safe to call from handlers and alongside the polling
+/// thread, which needs MPI initialized with THREAD_MULTIPLE. Without MPI,
+/// batches go through the Communicator and those for this process stay local.
+class ActiveMessages
+{
+public:
+  /** Sets up the runtime (handlers still to register)
+   * @param t_comm Processes exchanging calls
+   * @param t_threshold Batched bytes that trigger sending to a process
+   * @param t_tag Tag reserved for batches
+   */
+  ActiveMessages(Communicator &t_comm, size_t t_threshold=8192, int t_tag=7801)
+    : comm(t_comm), threshold(t_threshold), tag(t_tag), n_sent(0), n_executed(0), polling(false)
+  {
+    buffers.resize(comm.NumProcs());
+  }
+
+  ~ActiveMessages()
+  {
+    StopProgressThread();
+    WaitSends();
+  }
+
+  ActiveMessages(const ActiveMessages&) = delete;
+  ActiveMessages& operator=(const ActiveMessages&) = delete;
+
+  /** Registers handler(from_proc, args), to be called as Call(to_proc, id, args).
+   * Every process must register the same handlers in the same order.
+   * return the handler id
+   */
+  template<class A, class F>
+  int Register(F handler)
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    handlers.push_back([handler](int from_proc, UnpackArchive &ar) mutable {
+      A args;
+      Serialize(ar, args);
+      handler(from_proc, args);
+    });
+    return handlers.size()-1;
+  }
+
+  /// Calls handler id on to_proc with args, batched with other calls to it
+  template<class A>
+  void Call(int to_proc, int id, const A &args)
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    SizeArchive size_ar;
+    Serialize(size_ar, const_cast<A&>(args)); // Only read when saving
+    std::vector<char> &buff = buffers[to_proc];
+    size_t pos = buff.size();
+    buff.resize(pos + sizeof(int) + size_ar.size);
+    PackArchive ar(&buff[pos]);
+    ar.Bytes(&id, 1);
+    Serialize(ar, const_cast<A&>(args));
+    ++n_sent;
+    if (buff.size() >= threshold)
+      Flush(to_proc);
+  }
+
+  /// Sends the calls batched for to_proc
+  void Flush(int to_proc)
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    std::vector<char> &buff = buffers[to_proc];
+    if (buff.empty())
+      return;
+  #if USE_MPI
+    if (buff.size() > INT_MAX) {
+      std::cerr << "ERROR: Active message batch exceeds INT_MAX bytes!" << std::endl;
+      abort();
+    }
+    RetireSends();
+    in_flight.push_back(std::vector<char>());
+    in_flight.back().swap(buff);
+    requests.push_back(MPI_REQUEST_NULL);
+    MPI_Isend(in_flight.back().data(), in_flight.back().size(), MPI_BYTE, to_proc, tag, comm.MPIComm, &requests.back());
+  #else
+    if (to_proc == comm.MyProc()) {
+      arrived.push_back(std::vector<char>());
+      arrived.back().swap(buff);
+    } else {
+      comm.Send(to_proc, buff, tag);
+      buff.clear();
+    }
+  #endif
+  }
+
+  /// Sends every batch
+  void Flush()
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (int proc=0; proc<buffers.size(); ++proc)
+      Flush(proc);
+  }
+
+  /** Runs the calls that have arrived
+   * return the number of calls run
+   */
+  size_t Progress()
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    size_t n_before = n_executed;
+  #if USE_MPI
+    RetireSends();
+    while (true) {
+      int flag;
+      MPI_Message message;
+      MPI_Status status;
+      MPI_Improbe(MPI_ANY_SOURCE, tag, comm.MPIComm, &flag, &message, &status);
+      if (!flag)
+        break;
+      int bytes;
+      MPI_Get_count(&status, MPI_BYTE, &bytes);
+      PooledBuffer batch;
+      batch.buff.resize(bytes);
+      MPI_Mrecv(batch.buff.data(), bytes, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+      Dispatch(status.MPI_SOURCE, batch.buff);
+    }
+  #else
+    while (!arrived.empty()) {
+      std::vector<char> batch;
+      batch.swap(arrived.front());
+      arrived.pop_front();
+      Dispatch(comm.MyProc(), batch);
+    }
+    int from_proc;
+    while (comm.IProbe(Communicator::ANY_SOURCE, tag, from_proc)) {
+      std::vector<char> batch;
+      comm.Receive(from_proc, batch, tag);
+      Dispatch(from_proc, batch);
+    }
+  #endif
+    return n_executed - n_before;
+  }
+
+  /** Makes progress until every call made on any process, including calls
+   * made by handlers, has run (collective). Uses a non-blocking reduction
+   * of the call counts, repeated until two in a row agree and balance.
+   */
+  void Quiesce()
+  {
+    long last[2] = {-1, -1};
+    while (true) {
+      long counts[2], totals[2];
+      {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        Flush();
+        counts[0] = n_sent;
+        counts[1] = n_executed;
+      }
+    #if USE_MPI
+      MPI_Request request;
+      MPI_Iallreduce(counts, totals, 2, MPI_LONG, MPI_SUM, comm.MPIComm, &request);
+      for (int done=0; !done; ) {
+        Progress();
+        MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+      }
+    #else
+      Progress();
+      std::vector<long> my_counts(counts, counts+2), all_counts(2);
+      comm.AllSum(my_counts, all_counts);
+      totals[0] = all_counts[0];
+      totals[1] = all_counts[1];
+    #endif
+      if ((totals[0] == totals[1]) && (totals[0] == last[0]) && (totals[1] == last[1]))
+        break;
+      last[0] = totals[0];
+      last[1] = totals[1];
+    }
+  }
+
+  /// Starts a thread calling Progress() until StopProgressThread()
+  void StartProgressThread()
+  {
+  #if USE_MPI
+    if (COMM::GetThreadLevel() != COMM::THREAD_MULTIPLE) {
+      std::cerr << "ERROR: ActiveMessages polling thread needs MPI initialized with THREAD_MULTIPLE!" << std::endl;
+      abort();
+    }
+  #endif
+    if (polling)
+      return;
+    polling = true;
+    progress_thread = std::thread([this]() {
+      while (polling) {
+        Progress();
+        std::this_thread::yield();
+      }
+    });
+  }
+
+  void StopProgressThread()
+  {
+    if (!polling)
+      return;
+    polling = false;
+    progress_thread.join();
+  }
+
+private:
+  Communicator comm;
+  size_t threshold;
+  int tag;
+  long n_sent, n_executed; // Calls made and run by this process
+  std::recursive_mutex mutex; // Handlers may call back in
+  std::vector< std::function<void(int, UnpackArchive&)> > handlers;
+  std::vector< std::vector<char> > buffers; // Calls batched for each process
+  std::atomic<bool> polling;
+  std::thread progress_thread;
+#if USE_MPI
+  std::deque< std::vector<char> > in_flight; // Batches being sent
+  std::deque<MPI_Request> requests;
+
+  // Frees the oldest batches once sent
+  void RetireSends()
+  {
+    int flag = 1;
+    while (!requests.empty() && flag) {
+      MPI_Test(&requests.front(), &flag, MPI_STATUS_IGNORE);
+      if (flag) {
+        requests.pop_front();
+        in_flight.pop_front();
+      }
+    }
+  }
+#else
+  std::deque< std::vector<char> > arrived; // Batches flushed to this process
+#endif
+
+  void WaitSends()
+  {
+  #if USE_MPI
+    for (auto &request: requests)
+      MPI_Wait(&request, MPI_STATUS_IGNORE);
+    requests.clear();
+    in_flight.clear();
+  #endif
+  }
+
+  // Runs every call in a batch
+  void Dispatch(int from_proc, const std::vector<char> &batch)
+  {
+    UnpackArchive ar(batch.data());
+    while (ar.pos < batch.data() + batch.size()) {
+      int id;
+      ar.Bytes(&id, 1);
+      if ((id < 0) || (id >= handlers.size())) {
+        std::cerr << "ERROR: Active message for unregistered handler " << id << "!" << std::endl;
+        abort();
+      }
+      handlers[id](from_proc, ar);
+      ++n_executed;
+    }
+  }
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_ACTIVE_MESSAGE_H_
@@ -0,0 +1,207 @@
+#ifndef SCAFFOLD_COMMUNICATION_AGGREGATOR_H_
+#define SCAFFOLD_COMMUNICATION_AGGREGATOR_H_
+
+#include <deque>
+#include <vector>
+#include <iostream>
+#include <type_traits>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Coalesces many small messages (plain-old-data values) to the same few
+/// processes into batches, so each batch pays the per-message latency once.
+/// Push() buffers a value for its destination and sends the buffer as one
+/// non-blocking message once it reaches threshold bytes; Flush() sends the
+/// buffers early. Receivers take batches as they arrive with Poll(), and
+/// Finish() ends a step (collectively): it flushes everything, learns how
+/// many batches each process still has coming from a reduce-scatter of the
+/// per-destination batch counts, and hands over the rest. Steps alternate
+/// tags, so batches of the next step never mix into this one. Without MPI,
+/// batches go through the Communicator (whose Send never waits), and those
+/// for this process are kept locally.
+template<class T>
+class MessageAggregator
+{
+  static_assert(std::is_trivially_copyable<T>::value, "MessageAggregator sends values as raw bytes");
+
+public:
+  /** Starts the first step
+   * @param t_comm Processes exchanging messages
+   * @param t_threshold Buffered bytes that trigger sending a batch
+   * @param t_tag First of the two tags used for batches
+   */
+  MessageAggregator(Communicator &t_comm, size_t t_threshold=8192, int t_tag=7701)
+    : comm(t_comm), threshold(t_threshold), tag(t_tag), step(0), n_received(0)
+  {
+    n_procs = comm.NumProcs();
+    buffers.resize(n_procs);
+    n_sent.assign(n_procs, 0);
+  }
+
+  ~MessageAggregator() { WaitSends(); }
+
+  MessageAggregator(const MessageAggregator&) = delete;
+  MessageAggregator& operator=(const MessageAggregator&) = delete;
+
+  /// Buffers val for to_proc, sending the buffer if it is full
+  inline void Push(int to_proc, const T &val)
+  {
+    buffers[to_proc].push_back(val);
+    if (buffers[to_proc].size()*sizeof(T) >= threshold)
+      Flush(to_proc);
+  }
+
+  /// Sends what is buffered for to_proc
+  void Flush(int to_proc)
+  {
+    std::vector<T> &buff = buffers[to_proc];
+    if (buff.empty())
+      return;
+    ++n_sent[to_proc];
+  #if USE_MPI
+    RetireSends();
+    in_flight.push_back(std::vector<T>());
+    in_flight.back().swap(buff);
+    requests.push_back(MPI_REQUEST_NULL);
+    MPI_Isend(in_flight.back().data(), in_flight.back().size()*sizeof(T), MPI_BYTE, to_proc, StepTag(), comm.MPIComm, &requests.back());
+  #else
+    if (to_proc == comm.MyProc()) {
+      arrived.push_back(std::vector<T>());
+      arrived.back().swap(buff);
+    } else {
+      comm.Send(to_proc, buff, StepTag());
+      buff.clear();
+    }
+  #endif
+  }
+
+  /// Sends everything buffered
+  void Flush()
+  {
+    for (int proc=0; proc<n_procs; ++proc)
+      Flush(proc);
+  }
+
+  /** Takes a batch sent to this process this step, if one has arrived
+   * @param from_proc Sender of the batch
+   * @param batch Its values, in the order they were pushed
+   * return whether there was a batch
+   */
+  bool Poll(int &from_proc, std::vector<T> &batch)
+  {
+  #if USE_MPI
+    int flag;
+    MPI_Message message;
+    MPI_Status status;
+    MPI_Improbe(MPI_ANY_SOURCE, StepTag(), comm.MPIComm, &flag, &message, &status);
+    if (!flag)
+      return false;
+    ReceiveBatch(message, status, from_proc, batch);
+    return true;
+  #else
+    if (arrived.empty()) {
+      if (!comm.IProbe(Communicator::ANY_SOURCE, StepTag(), from_proc))
+        return false;
+      comm.Receive(from_proc, batch, StepTag());
+    } else {
+      from_proc = comm.MyProc();
+      batch.swap(arrived.front());
+      arrived.pop_front();
+    }
+    ++n_received;
+    return true;
+  #endif
+  }
+
+  /** Ends the step (collective): flushes, then calls handler(from_proc, batch)
+   * for every batch sent to this process this step and not yet polled
+   */
+  template<class F>
+  void Finish(F handler)
+  {
+    Flush();
+    int from_proc;
+    std::vector<T> batch;
+  #if USE_MPI
+    int n_expected;
+    MPI_Reduce_scatter_block(n_sent.data(), &n_expected, 1, MPI_INT, MPI_SUM, comm.MPIComm);
+    while (n_received < n_expected) {
+      MPI_Message message;
+      MPI_Status status;
+      MPI_Mprobe(MPI_ANY_SOURCE, StepTag(), comm.MPIComm, &message, &status);
+      ReceiveBatch(message, status, from_proc, batch);
+      handler(from_proc, batch);
+    }
+    WaitSends();
+  #else
+    std::vector<int> n_total(n_procs);
+    comm.AllSum(n_sent, n_total);
+    int n_expected = n_total[comm.MyProc()];
+    while (n_received < n_expected) {
+      if (arrived.empty())
+        comm.Probe(Communicator::ANY_SOURCE, StepTag(), from_proc);
+      Poll(from_proc, batch);
+      handler(from_proc, batch);
+    }
+  #endif
+    n_sent.assign(n_procs, 0);
+    n_received = 0;
+    ++step;
+  }
+
+private:
+  Communicator comm;
+  int n_procs;
+  size_t threshold;
+  int tag, step;
+  int n_received; // Batches received this step
+  std::vector<int> n_sent; // Batches sent to each process this step
+  std::vector< std::vector<T> > buffers; // Values waiting for each process
+
+  inline int StepTag() { return tag + (step % 2); }
+
+#if USE_MPI
+  std::deque< std::vector<T> > in_flight; // Batches being sent
+  std::deque<MPI_Request> requests;
+
+  void ReceiveBatch(MPI_Message &message, MPI_Status &status, int &from_proc, std::vector<T> &batch)
+  {
+    int bytes;
+    MPI_Get_count(&status, MPI_BYTE, &bytes);
+    batch.resize(bytes/sizeof(T));
+    MPI_Mrecv(batch.data(), bytes, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+    from_proc = status.MPI_SOURCE;
+    ++n_received;
+  }
+
+  // Frees the oldest batches once sent
+  void RetireSends()
+  {
+    int flag = 1;
+    while (!requests.empty() && flag) {
+      MPI_Test(&requests.front(), &flag, MPI_STATUS_IGNORE);
+      if (flag) {
+        requests.pop_front();
+        in_flight.pop_front();
+      }
+    }
+  }
+#else
+  std::deque< std::vector<T> > arrived; // Batches flushed to this process
+#endif
+
+  void WaitSends()
+  {
+  #if USE_MPI
+    for (auto &request: requests)
+      MPI_Wait(&request, MPI_STATUS_IGNORE);
+    requests.clear();
+    in_flight.clear();
+  #endif
+  }
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_AGGREGATOR_H_
@@ -0,0 +1,185 @@
+#ifndef SCAFFOLD_COMMUNICATION_COMM_PROFILE_H_
+#define SCAFFOLD_COMMUNICATION_COMM_PROFILE_H_
+
+// Optional instrumentation of Communicator calls, enabled with USE_COMM_PROFILE.
+// When disabled the SCAFFOLD_COMM_PROFILE macros expand to nothing.
+
+#if USE_MPI && USE_COMM_PROFILE
+  #include <string>
+  #include <iostream>
+  #include <iomanip>
+  #include <vector>
+#endif
+#include "mpi_datatype.h"
+
+namespace scaffold { namespace parallel {
+
+#if USE_MPI && USE_COMM_PROFILE
+
+/// Profiled Communicator operations
+enum CommOp { COMM_SEND, COMM_RECEIVE, COMM_SENDRECEIVE, COMM_BROADCAST, COMM_REDUCE, COMM_ALLREDUCE,
+              COMM_GATHER, COMM_GATHERV, COMM_ALLGATHER, COMM_ALLGATHERV, COMM_ALLGATHERCOLS, COMM_SCATTER, COMM_SCATTERV,
+              COMM_ALLTOALL, COMM_ALLTOALLV, COMM_SCAN, COMM_EXSCAN, COMM_BARRIER, N_COMM_OPS };
+
+inline const char* CommOpName(int op)
+{
+  const char* names[] = {"Send", "Receive", "SendReceive", "Broadcast", "Reduce", "AllReduce",
+                         "Gather", "Gatherv", "AllGather", "AllGatherv", "AllGatherCols", "Scatter", "Scatterv",
+                         "Alltoall", "Alltoallv", "Scan", "ExScan", "Barrier"};
+  return names[op];
+}
+
+/// Per-process tallies of call counts, bytes moved, time spent and, for
+/// collectives, time waiting for the slowest process to arrive
+class CommProfiler
+{
+public:
+  static CommProfiler& Get()
+  {
+    static CommProfiler profiler;
+    return profiler;
+  }
+
+  // Fields of each tally
+  enum { CALLS, BYTES, TIME, WAIT, N_FIELDS };
+
+  /// Whether collectives first measure load imbalance with a barrier (perturbs timings)
+  bool measure_wait;
+
+  std::vector<double> tallies; // N_COMM_OPS x N_FIELDS
+
+  inline void Record(int op, double bytes, double time, double wait)
+  {
+  #if USE_OPENMP
+    #pragma omp critical(scaffold_comm_profile)
+  #endif
+    {
+      double *tally = &tallies[op*N_FIELDS];
+      tally[CALLS] += 1.;
+      tally[BYTES] += bytes;
+      tally[TIME] += time;
+      tally[WAIT] += wait;
+    }
+  }
+
+  inline void Reset() { tallies.assign(N_COMM_OPS*N_FIELDS, 0.); }
+
+  /// Sum, min and max of the tallies over the processes of comm (collective)
+  void Aggregate(MPI_Comm comm, std::vector<double> &sum, std::vector<double> &min, std::vector<double> &max)
+  {
+    sum.resize(tallies.size());
+    min.resize(tallies.size());
+    max.resize(tallies.size());
+    MPI_Allreduce(tallies.data(), sum.data(), tallies.size(), MPI_DOUBLE, MPI_SUM, comm);
+    MPI_Allreduce(tallies.data(), min.data(), tallies.size(), MPI_DOUBLE, MPI_MIN, comm);
+    MPI_Allreduce(tallies.data(), max.data(), tallies.size(), MPI_DOUBLE, MPI_MAX, comm);
+  }
+
+  /// Prints a summary aggregated over comm on its process 0 (collective)
+  void Report(std::ostream &out, MPI_Comm comm=MPI_COMM_WORLD)
+  {
+    std::vector<double> sum, min, max;
+    Aggregate(comm, sum, min, max);
+    int proc, n_procs;
+    MPI_Comm_rank(comm, &proc);
+    MPI_Comm_size(comm, &n_procs);
+    if (proc != 0)
+      return;
+    out << "# Communication profile over " << n_procs << " processes (times in s, averages per process)" << std::endl;
+    out << std::setw(14) << "# Operation" << std::setw(12) << "Calls" << std::setw(14) << "Bytes"
+        << std::setw(12) << "Time" << std::setw(12) << "MaxTime" << std::setw(12) << "Wait"
+        << std::setw(12) << "MaxWait" << std::setw(12) << "Imbalance" << std::endl;
+    for (int op=0; op<N_COMM_OPS; ++op) {
+      int i = op*N_FIELDS;
+      if (sum[i+CALLS] == 0.)
+        continue;
+      double avg_time = sum[i+TIME]/n_procs;
+      out << std::setw(14) << CommOpName(op) << std::setw(12) << sum[i+CALLS]/n_procs
+          << std::setw(14) << sum[i+BYTES]/n_procs << std::setw(12) << avg_time
+          << std::setw(12) << max[i+TIME] << std::setw(12) << sum[i+WAIT]/n_procs
+          << std::setw(12) << max[i+WAIT] << std::setw(12) << (avg_time > 0. ? max[i+TIME]/avg_time : 1.) << std::endl;
+    }
+  }
+
+  /** Writes the aggregated tallies as N_COMM_OPS x N_FIELDS datasets (collective)
+   * @param out io::IO (or similar) output, written by process 0 of comm
+   * @param prefix Existing group to write into, e.g. "/CommProfile/"
+   */
+  template<class IO>
+  void Write(IO &out, const std::string &prefix, MPI_Comm comm=MPI_COMM_WORLD)
+  {
+    std::vector<double> sum, min, max;
+    Aggregate(comm, sum, min, max);
+    int proc;
+    MPI_Comm_rank(comm, &proc);
+    if (proc != 0)
+      return;
+    matrix::mat<double> sum_mat(N_FIELDS, N_COMM_OPS), min_mat(N_FIELDS, N_COMM_OPS), max_mat(N_FIELDS, N_COMM_OPS);
+    for (int i=0; i<tallies.size(); ++i) {
+      sum_mat(i%N_FIELDS, i/N_FIELDS) = sum[i];
+      min_mat(i%N_FIELDS, i/N_FIELDS) = min[i];
+      max_mat(i%N_FIELDS, i/N_FIELDS) = max[i];
+    }
+    out.Write(prefix + "sum", sum_mat);
+    out.Write(prefix + "min", min_mat);
+    out.Write(prefix + "max", max_mat);
+  }
+
+private:
+  CommProfiler()
+    : measure_wait(false)
+  {
+    Reset();
+  }
+};
+
+/// Records one call from construction to destruction
+class CommTimer
+{
+public:
+  CommTimer(int t_op, double t_bytes)
+    : op(t_op), bytes(t_bytes), wait(0.)
+  {
+    start = MPI_Wtime();
+  }
+
+  // Collective version, optionally timing arrival imbalance first
+  CommTimer(int t_op, double t_bytes, MPI_Comm comm)
+    : op(t_op), bytes(t_bytes), wait(0.)
+  {
+    start = MPI_Wtime();
+    if (CommProfiler::Get().measure_wait) {
+      MPI_Barrier(comm);
+      wait = MPI_Wtime() - start;
+    }
+  }
+
+  ~CommTimer()
+  {
+    CommProfiler::Get().Record(op, bytes, MPI_Wtime() - start, wait);
+  }
+
+private:
+  int op;
+  double bytes, start, wait;
+};
+
+/// Bytes held by a buffer with MPITypeTraits
+template<class T>
+inline double CommBytes(T &val)
+{
+  int type_size;
+  MPI_Type_size(MPITypeTraits<T>::GetType(val), &type_size);
+  return double(MPITypeTraits<T>::GetSize(val))*type_size;
+}
+
+  #define SCAFFOLD_COMM_PROFILE(op, bytes) CommTimer comm_timer(op, bytes)
+  #define SCAFFOLD_COMM_PROFILE_COLLECTIVE(op, bytes, comm) CommTimer comm_timer(op, bytes, comm)
+#else
+  #define SCAFFOLD_COMM_PROFILE(op, bytes)
+  #define SCAFFOLD_COMM_PROFILE_COLLECTIVE(op, bytes, comm)
+#endif
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_COMM_PROFILE_H_
@@ -0,0 +1,161 @@
+#ifndef SCAFFOLD_COMMUNICATION_COMM_TUNING_H_
+#define SCAFFOLD_COMMUNICATION_COMM_TUNING_H_
+
+// Tuning tables measured by scaffold_comm_bench (tests/src/comm_bench.cc),
+// stored as XML and loaded at startup to set Communicator's segment sizes
+// and broadcast algorithms. Loading is opt-in: COMM::Init applies the table
+// named by the SCAFFOLD_COMM_TUNING environment variable, if set.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include "communication.h"
+#include "../io/io_xml.h"
+
+namespace scaffold { namespace parallel {
+
+inline const char* BroadcastAlgorithmName(BroadcastAlgorithm algo)
+{
+  const char* names[] = {"auto", "native", "binomial", "chain", "scatter_allgather"};
+  return names[algo];
+}
+
+inline BroadcastAlgorithm BroadcastAlgorithmFromName(const std::string &name)
+{
+  for (int algo=BCAST_AUTO; algo<=BCAST_SCATTER_ALLGATHER; ++algo)
+    if (name == BroadcastAlgorithmName(BroadcastAlgorithm(algo)))
+      return BroadcastAlgorithm(algo);
+  std::cerr << "ERROR: Unknown broadcast algorithm " << name << "!" << std::endl;
+  abort();
+}
+
+/// Communicator settings tuned for communicators of n_procs processes
+struct CommTuning
+{
+  CommTuning()
+    : n_procs(1), segment_size(Communicator::SegmentSize()), pipeline_depth(Communicator::PipelineDepth())
+  {}
+
+  int n_procs;
+  size_t segment_size; // See Communicator::SegmentSize
+  int pipeline_depth; // See Communicator::PipelineDepth
+  std::vector< std::pair<size_t, BroadcastAlgorithm> > broadcast; // See Communicator::BroadcastTable
+
+  /// Makes these the Communicator settings
+  void Apply()
+  {
+    Communicator::SegmentSize() = segment_size;
+    Communicator::PipelineDepth() = pipeline_depth;
+    Communicator::BroadcastTable() = broadcast;
+  }
+
+  io::Node ToNode()
+  {
+    io::Node node;
+    node.name = "CommTuning";
+    node.attributes["n_procs"] = std::to_string(n_procs);
+    node.attributes["segment_size"] = std::to_string(segment_size);
+    node.attributes["pipeline_depth"] = std::to_string(pipeline_depth);
+    for (auto &entry: broadcast) {
+      io::Node child;
+      child.name = "Broadcast";
+      child.attributes["min_bytes"] = std::to_string(entry.first);
+      child.attributes["algorithm"] = BroadcastAlgorithmName(entry.second);
+      node.child_nodes.push_back(child);
+    }
+    return node;
+  }
+
+  void FromNode(io::Node &node)
+  {
+    std::vector<char> buffer;
+    io::Input in(node, buffer);
+    n_procs = in.GetAttribute<int>("n_procs");
+    segment_size = std::stoul(in.GetAttribute<std::string>("segment_size"));
+    pipeline_depth = in.GetAttribute<int>("pipeline_depth");
+    broadcast.clear();
+    for (auto &child: in.GetChildList("Broadcast"))
+      broadcast.push_back(std::make_pair(std::stoul(child.GetAttribute<std::string>("min_bytes")),
+                                         BroadcastAlgorithmFromName(child.GetAttribute<std::string>("algorithm"))));
+  }
+};
+
+/** Writes tunings to filename as XML
+ * @param tunings One per communicator size measured
+ */
+inline void SaveCommTuning(const std::string &filename, std::vector<CommTuning> &tunings)
+{
+  io::Input out;
+  out.node.name = "Input";
+  for (auto &tuning: tunings)
+    out.node.child_nodes.push_back(tuning.ToNode());
+  std::ofstream out_file(filename);
+  out_file << out.GetString();
+}
+
+/** Reads the tunings in filename on process 0, shares them, and applies the
+ * one measured on the most processes not exceeding comm's (collective)
+ * return whether a tuning was applied (false if filename does not exist)
+ */
+inline bool LoadCommTuning(Communicator &comm, const std::string &filename)
+{
+  io::Node root;
+  int found = 0;
+  if (comm.MyProc() == 0) {
+    found = std::ifstream(filename).good();
+    if (found) {
+      io::Input in;
+      in.Load(filename);
+      root = in.node;
+    }
+  }
+  comm.Broadcast(0, found);
+  if (!found)
+    return false;
+  comm.Broadcast(0, root);
+
+  int n_procs = comm.NumProcs();
+  CommTuning best;
+  bool applied = false;
+  for (auto &node: root.child_nodes) {
+    if (node.name != "CommTuning")
+      continue;
+    CommTuning tuning;
+    tuning.FromNode(node);
+    if ((tuning.n_procs <= n_procs) && (!applied || (tuning.n_procs > best.n_procs))) {
+      best = tuning;
+      applied = true;
+    }
+  }
+  if (applied)
+    best.Apply();
+  return applied;
+}
+
+/** Loads the tuning table named by the SCAFFOLD_COMM_TUNING environment
+ * variable for the world communicator (collective, run by COMM::Init)
+ * return whether a tuning was applied (false if the variable is unset)
+ */
+inline bool LoadCommTuningFromEnv()
+{
+  const char* filename = std::getenv("SCAFFOLD_COMM_TUNING");
+  if (!filename || !*filename)
+    return false;
+  Communicator world;
+  bool applied = LoadCommTuning(world, filename);
+  if (!applied && (world.MyProc() == 0))
+    std::cerr << "WARNING: No tuning for " << world.NumProcs() << " processes read from " << filename << "." << std::endl;
+  return applied;
+}
+
+namespace {
+  // Every translation unit seeing this header registers the same loader with COMM::Init
+  const bool comm_tuning_hooked = (COMM::TuningHook() = [](){ LoadCommTuningFromEnv(); }, true);
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_COMM_TUNING_H_
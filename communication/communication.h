@@ -7,20 +7,95 @@
 #if USE_OPENMP
   #include <omp.h>
 #endif
+#include <iostream>
+#include <vector>
+#include <climits>
+#include <utility>
+#include <algorithm>
 #include "mpi_datatype.h"
+#include "comm_profile.h"
+#include "reduce_op.h"
+#include "serialize.h"
+#if USE_THREAD_COMM
+  #if USE_MPI
+    #error "USE_THREAD_COMM replaces USE_MPI; define only one"
+  #endif
+  #include "thread_comm.h"
+#endif
 
 namespace scaffold { namespace parallel {
 
 namespace COMM {
+  /// Levels of thread support, from only one thread in the process to any thread calling MPI concurrently
+  enum ThreadLevel { THREAD_SINGLE, THREAD_FUNNELED, THREAD_SERIALIZED, THREAD_MULTIPLE };
+
+  /// Called at the end of Init once communicators work (comm_tuning.h sets it to load a tuning table)
+  typedef void (*InitHook)();
+  inline InitHook& TuningHook()
+  {
+    static InitHook hook = nullptr;
+    return hook;
+  }
+
+  inline void RunTuningHook()
+  {
+    if (TuningHook())
+      TuningHook()();
+  }
+
   #ifdef USE_MPI // Parallel version
     inline void Init (int argc, char **argv)
     {
       MPI_Init(&argc, &argv);
       int proc;
       MPI_Comm_rank(MPI_COMM_WORLD, &proc);
+      RunTuningHook();
+    }
+
+    // Conversions between ThreadLevel and MPI's thread levels
+    inline int ToMPIThreadLevel(ThreadLevel level)
+    {
+      const int mpi_levels[] = {MPI_THREAD_SINGLE, MPI_THREAD_FUNNELED, MPI_THREAD_SERIALIZED, MPI_THREAD_MULTIPLE};
+      return mpi_levels[level];
+    }
+
+    inline ThreadLevel FromMPIThreadLevel(int mpi_level)
+    {
+      for (int level=THREAD_MULTIPLE; level>THREAD_SINGLE; --level)
+        if (ToMPIThreadLevel(ThreadLevel(level)) == mpi_level)
+          return ThreadLevel(level);
+      return THREAD_SINGLE;
+    }
+
+    /// Initialize with a requested level of thread support, returning the level provided
+    inline ThreadLevel Init (int argc, char **argv, ThreadLevel required)
+    {
+      int provided;
+      MPI_Init_thread(&argc, &argv, ToMPIThreadLevel(required), &provided);
+      ThreadLevel level = FromMPIThreadLevel(provided);
+      int proc;
+      MPI_Comm_rank(MPI_COMM_WORLD, &proc);
+      if ((level < required) && (proc == 0))
+        std::cerr << "WARNING: MPI provides thread level " << level << " of " << required << " requested." << std::endl;
+      RunTuningHook();
+      return level;
     }
 
-    inline void Finalize() { MPI_Finalize(); }
+    /// Level of thread support provided by MPI
+    inline ThreadLevel GetThreadLevel()
+    {
+      int provided;
+      MPI_Query_thread(&provided);
+      return FromMPIThreadLevel(provided);
+    }
+
+    inline void Finalize()
+    {
+    #if USE_COMM_PROFILE
+      CommProfiler::Get().Report(std::cout);
+    #endif
+      MPI_Finalize();
+    }
     inline void BarrierSync() { MPI_Barrier(MPI_COMM_WORLD); }
 
     // Return process number
@@ -31,13 +106,84 @@ namespace COMM {
       return (proc);
     }
 
+  #elif USE_THREAD_COMM // Thread version, processes being threads started by Launch (see thread_comm.h)
+    inline void Init (int argc, char **argv) { RunTuningHook(); }
+    inline ThreadLevel Init (int argc, char **argv, ThreadLevel required) { RunTuningHook(); return THREAD_MULTIPLE; }
+    inline ThreadLevel GetThreadLevel() { return THREAD_MULTIPLE; }
+    inline void Finalize () {}
+    inline void BarrierSync() { CurrentThreadRank().world->Barrier(); }
+    inline int WorldProc() { return CurrentThreadRank().proc; }
+
+    /** Runs f() on n_threads threads, the processes of a new world (see
+     * Communicator::SetWorld), and waits for them. The calling thread is
+     * process 0 and gets its own world back afterwards.
+     * @param n_threads Number of processes
+     * @param f Functor run by every process
+     */
+    template<class F>
+    void Launch(int n_threads, F f)
+    {
+      std::shared_ptr<ThreadWorld> world = std::make_shared<ThreadWorld>(n_threads);
+      std::vector<std::thread> threads;
+      for (int proc=1; proc<n_threads; ++proc)
+        threads.push_back(std::thread([&world, &f, proc]() {
+          CurrentThreadRank().world = world;
+          CurrentThreadRank().proc = proc;
+          f();
+        }));
+      ThreadRank caller = CurrentThreadRank();
+      CurrentThreadRank().world = world;
+      CurrentThreadRank().proc = 0;
+      f();
+      for (auto &thread: threads)
+        thread.join();
+      CurrentThreadRank() = caller;
+    }
+
   #else // Serial version
-    inline void Init (int argc, char **argv) {}
+    inline void Init (int argc, char **argv) { RunTuningHook(); }
+    inline ThreadLevel Init (int argc, char **argv, ThreadLevel required) { RunTuningHook(); return THREAD_MULTIPLE; }
+    inline ThreadLevel GetThreadLevel() { return THREAD_MULTIPLE; }
     inline void Finalize () {}
     inline int WorldProc() {return (0);}
   #endif
 }
 
+/// Columns held by proc when cols columns are split in contiguous blocks (as in ScatterCols)
+inline void ColBlock(int cols, int proc, int n_procs, int &first_col, int &n_cols)
+{
+  first_col = proc*(cols/n_procs) + std::min(proc, cols%n_procs);
+  n_cols = cols/n_procs + ((cols%n_procs)>proc);
+}
+
+/// Algorithms for Communicator::Broadcast. Native leaves the choice to MPI;
+/// binomial tree suits latency-bound messages, while pipelined chain and
+/// scatter+allgather keep every link busy on large ones. Auto picks by size.
+enum BroadcastAlgorithm { BCAST_AUTO, BCAST_NATIVE, BCAST_BINOMIAL, BCAST_CHAIN, BCAST_SCATTER_ALLGATHER };
+
+/// Per-process element counts of a variable-count gather, and where each
+/// process's elements start in the result (see Communicator::AllGatherv).
+/// Keeping one across calls reuses the counts instead of exchanging them
+/// again, so every process must Reset() its copy when any count changes.
+class GathervCounts
+{
+public:
+  GathervCounts() : my_count(-1), to_proc(-1) {}
+
+  inline void Reset() { my_count = -1; }
+
+  // Whether the counts are known where a gather to t_to_proc (-1 for all) needs them
+  inline bool Cached(int t_to_proc) { return (my_count >= 0) && ((to_proc < 0) || (to_proc == t_to_proc)); }
+
+  // Elements gathered over all processes
+  inline int Total() { return offsets.empty() ? 0 : offsets.back(); }
+
+  int my_count; // This process's count when the counts were exchanged
+  int to_proc; // Process the counts were gathered to, or -1 for all
+  std::vector<int> counts; // Elements from each process
+  std::vector<int> offsets; // Start of each process's elements, then the total
+};
+
 class Communicator
 {
 public:
@@ -81,14 +227,259 @@ public:
 
   void BarrierSync()
   {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_BARRIER, 0, MPIComm);
     MPI_Barrier(MPIComm);
   }
 
+  /// Largest element count handed to a single MPI call. Larger buffers are
+  /// sent as pipelined chunks of this size or through a derived datatype,
+  /// which lifts MPI's 2^31 element count limit.
+  static size_t& MaxCount()
+  {
+    static size_t max_count = INT_MAX;
+    return max_count;
+  }
+
+  /// Address of element offset of a buffer of MPI type
+  static inline void* ChunkAddr(void* addr, size_t offset, MPI_Datatype type)
+  {
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(type, &lb, &extent);
+    return static_cast<char*>(addr) + offset*extent;
+  }
+
+  /// Starts one non-blocking call per chunk of count elements
+  template<class F>
+  static void StartChunks(size_t count, std::vector<MPI_Request> &requests, F start_chunk)
+  {
+    for (size_t offset=0; offset<count; offset+=MaxCount()) {
+      requests.push_back(MPI_REQUEST_NULL);
+      start_chunk(offset, int(std::min(MaxCount(), count-offset)), &requests.back());
+    }
+  }
+
+  /// Starts one non-blocking call per chunk of count elements and waits for them all
+  template<class F>
+  static int Pipeline(size_t count, F start_chunk)
+  {
+    std::vector<MPI_Request> requests;
+    StartChunks(count, requests, start_chunk);
+    return MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+  }
+
+  /// Stops with an error if a count passed to MPI as an int would overflow
+  static inline void CheckIntCount(size_t count, const char* op)
+  {
+    if (count > INT_MAX) {
+      std::cerr << "ERROR: " << op << " takes at most INT_MAX elements per buffer!" << std::endl;
+      abort();
+    }
+  }
+
+  /// Committed datatype covering count elements of type, for calls taking a single count (free after use)
+  static MPI_Datatype LargeType(size_t count, MPI_Datatype type)
+  {
+    int n_chunks = count/MaxCount();
+    int remainder = count%MaxCount();
+    MPI_Datatype chunk, chunks, large;
+    MPI_Type_contiguous(MaxCount(), type, &chunk);
+    MPI_Type_contiguous(n_chunks, chunk, &chunks);
+    int lengths[2] = {1, remainder};
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Aint displacements[2] = {0, MPI_Aint(n_chunks)*MaxCount()*extent};
+    MPI_Datatype types[2] = {chunks, type};
+    MPI_Type_create_struct(2, lengths, displacements, types, &large);
+    MPI_Type_commit(&large);
+    MPI_Type_free(&chunk);
+    MPI_Type_free(&chunks);
+    return large;
+  }
+
+  // Address and element type of the buffers of variable-count collectives
+  template<class T>
+  static inline void* VarAddr(matrix::vec<T> &val)
+  {
+  #ifdef USE_ARMADILLO
+    return val.memptr();
+  #endif
+  #ifdef USE_EIGEN
+    return val.data();
+  #endif
+  }
+  template<class T>
+  static inline void* VarAddr(std::vector<T> &val) { return val.data(); }
+  template<class V>
+  static inline MPI_Datatype VarType(V &val)
+  {
+    typename V::value_type elem = typename V::value_type();
+    return MPITypeTraits<typename V::value_type>::GetType(elem);
+  }
+
+  // Key of NextEpoch's counter, freed with the communicator and not copied by Dup
+  static int CreateEpochKeyval()
+  {
+    int keyval;
+    MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, [](MPI_Comm comm, int keyval, void* epoch, void* extra) {
+      delete static_cast<long*>(epoch);
+      return int(MPI_SUCCESS);
+    }, &keyval, 0);
+    return keyval;
+  }
+
+  /// Fills counts with every process's element count (on to_proc, or everywhere
+  /// if to_proc < 0), unless they are cached
+  void ExchangeCounts(int to_proc, size_t my_count, GathervCounts &counts)
+  {
+    if (counts.Cached(to_proc)) {
+      if (size_t(counts.my_count) != my_count) {
+        std::cerr << "ERROR: Count changed since GathervCounts was filled; Reset() it on every process!" << std::endl;
+        abort();
+      }
+      return;
+    }
+    if (my_count > INT_MAX) {
+      std::cerr << "ERROR: Variable-count gathers take at most INT_MAX elements per process!" << std::endl;
+      abort();
+    }
+    int n_procs = NumProcs();
+    counts.my_count = my_count;
+    counts.to_proc = to_proc;
+    counts.counts.assign(n_procs, 0);
+    counts.offsets.assign(n_procs+1, 0);
+    if (to_proc < 0)
+      MPI_Allgather(&counts.my_count, 1, MPI_INT, counts.counts.data(), 1, MPI_INT, MPIComm);
+    else
+      MPI_Gather(&counts.my_count, 1, MPI_INT, counts.counts.data(), 1, MPI_INT, to_proc, MPIComm);
+    long total = 0;
+    for (int proc=0; proc<n_procs; ++proc) {
+      total += counts.counts[proc];
+      if (total > INT_MAX) {
+        std::cerr << "ERROR: Variable-count gathers take at most INT_MAX elements in all!" << std::endl;
+        abort();
+      }
+      counts.offsets[proc+1] = total;
+    }
+  }
+
+  /// Gathers from_addr's counts.my_count elements into to_addr at counts.offsets
+  int GathervBuffer(int to_proc, void* from_addr, void* to_addr, MPI_Datatype type, GathervCounts &counts)
+  {
+    if (to_proc < 0)
+      return MPI_Allgatherv(from_addr, counts.my_count, type, to_addr, counts.counts.data(), counts.offsets.data(), type, MPIComm);
+    return MPI_Gatherv(from_addr, counts.my_count, type, to_addr, counts.counts.data(), counts.offsets.data(), type, to_proc, MPIComm);
+  }
+
   void Split(int color, Communicator &new_comm)
   {
     MPI_Comm_split(MPIComm, color, 0, &(new_comm.MPIComm));
   }
 
+  /// Copy of this communicator with its own message space
+  void Dup(Communicator &new_comm)
+  {
+    MPI_Comm_dup(MPIComm, &(new_comm.MPIComm));
+  }
+
+  /// Releases a communicator created by Split, SplitShared, Dup or Subset
+  void Free()
+  {
+    if ((MPIComm != MPI_COMM_WORLD) && (MPIComm != MPI_COMM_NULL))
+      MPI_Comm_free(&MPIComm);
+  }
+
+  /// Splits into communicators of the processes sharing a node (and so its memory)
+  void SplitShared(Communicator &node_comm)
+  {
+    MPI_Comm_split_type(MPIComm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &(node_comm.MPIComm));
+  }
+
+  /** Counts calls on this MPI communicator, kept as an attribute of it so every
+   * Communicator copy sharing it sees the same count. Collective operations
+   * that probe for messages call it once per call, on every process in the
+   * same order, to pick tags that differ from the previous call's.
+   * return the number of earlier calls
+   */
+  long NextEpoch()
+  {
+    static int keyval = CreateEpochKeyval();
+    long *epoch;
+    int found;
+    MPI_Comm_get_attr(MPIComm, keyval, &epoch, &found);
+    if (!found) {
+      epoch = new long(0);
+      MPI_Comm_set_attr(MPIComm, keyval, epoch);
+    }
+    return (*epoch)++;
+  }
+
+  /** Arranges the processes in a Cartesian grid
+   * @param dims Processes along each dimension, with zeros filled in by MPI_Dims_create
+   * @param periods Whether each dimension wraps around
+   * @param cart_comm Communicator with the grid topology (MPI_COMM_NULL on processes left out)
+   * @param reorder Whether MPI may renumber the processes to suit the machine
+   */
+  void CartCreate(std::vector<int> &dims, const std::vector<int> &periods, Communicator &cart_comm, bool reorder=false)
+  {
+    MPI_Dims_create(NumProcs(), dims.size(), dims.data());
+    std::vector<int> wrap(periods);
+    MPI_Cart_create(MPIComm, dims.size(), dims.data(), wrap.data(), reorder, &(cart_comm.MPIComm));
+  }
+
+  /// Number of dimensions of a Cartesian communicator
+  int CartDims()
+  {
+    int n_dims;
+    MPI_Cartdim_get(MPIComm, &n_dims);
+    return n_dims;
+  }
+
+  /// Processes disp steps down (source) and up (dest) along dim, MPI_PROC_NULL past a non-periodic edge
+  void CartShift(int dim, int disp, int &source, int &dest)
+  {
+    MPI_Cart_shift(MPIComm, dim, disp, &source, &dest);
+  }
+
+  /// Grid coordinates of a process
+  void CartCoords(int proc, std::vector<int> &coords)
+  {
+    coords.resize(CartDims());
+    MPI_Cart_coords(MPIComm, proc, coords.size(), coords.data());
+  }
+
+  /// Process at grid coordinates (wrapped along periodic dimensions)
+  int CartRank(const std::vector<int> &coords)
+  {
+    std::vector<int> c(coords);
+    int proc;
+    MPI_Cart_rank(MPIComm, c.data(), &proc);
+    return proc;
+  }
+
+  /** Allocates memory shared by all processes of a node communicator (see SplitShared).
+   * Only process 0 allocates, so the node holds a single copy.
+   * @param size Number of elements
+   * @param ptr Set to the start of the shared memory on every process
+   * @param win Window backing the memory, to be released with FreeShared
+   * return the MPI status
+   */
+  template<class T>
+  int AllocateShared(size_t size, T* &ptr, MPI_Win &win)
+  {
+    MPI_Aint my_bytes = (MyProc() == 0) ? size*sizeof(T) : 0;
+    T* my_ptr;
+    int status = MPI_Win_allocate_shared(my_bytes, sizeof(T), MPI_INFO_NULL, MPIComm, &my_ptr, &win);
+    MPI_Aint bytes;
+    int disp_unit;
+    MPI_Win_shared_query(win, 0, &bytes, &disp_unit, &ptr);
+    return status;
+  }
+
+  void FreeShared(MPI_Win &win)
+  {
+    MPI_Win_free(&win);
+  }
+
   void Subset(matrix::vec<int> &ranks, Communicator &new_comm)
   {
     MPI_Group my_group, new_group;
@@ -111,6 +502,7 @@ public:
   template <typename T>
   int AllGatherCols(matrix::mat<T> &buff)
   {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_ALLGATHERCOLS, CommBytes(buff), MPIComm);
     int n_procs = NumProcs();
     int my_proc = MyProc();
   #ifdef USE_ARMADILLO
@@ -128,11 +520,11 @@ public:
     int curr_col = 0;
     for (int proc=0; proc<n_procs; proc++) {
       int proc_cols = cols/n_procs + ((cols%n_procs)>proc);
-      displacements[proc] = rows*curr_col;
-      receive_counts[proc] = rows*proc_cols;
+      displacements[proc] = curr_col;
+      receive_counts[proc] = proc_cols;
       if (proc == my_proc) {
         sendBuf = &(buff(0,curr_col));
-        sendCount = rows*proc_cols;
+        sendCount = proc_cols;
       }
       curr_col += proc_cols;
     }
@@ -142,181 +534,1503 @@ public:
   #ifdef USE_EIGEN
     receiveBuf = buff.data();
   #endif
-    return MPI_Allgatherv(sendBuf, sendCount, MPI_DOUBLE, receiveBuf, receive_counts, displacements, MPI_DOUBLE, MPIComm);
+    // Count whole columns so large matrices stay within int counts
+    MPI_Datatype col_type;
+    MPI_Type_contiguous(rows, MPITypeTraits<matrix::mat<T>>::GetType(buff), &col_type);
+    MPI_Type_commit(&col_type);
+    int status = MPI_Allgatherv(sendBuf, sendCount, col_type, receiveBuf, receive_counts, displacements, col_type, MPIComm);
+    MPI_Type_free(&col_type);
+    return status;
   }
 
-  // Send
-  template<class T>
-  inline int Send(int to_proc, T &val)
+  /// Wildcards of Receive, ReceiveResize and Probe, and the process past a non-periodic Cartesian edge
+  enum { ANY_SOURCE = MPI_ANY_SOURCE, ANY_TAG = MPI_ANY_TAG, PROC_NULL = MPI_PROC_NULL };
+
+  /// Waits for a message from from_proc with tag (either may be a wildcard) without receiving it, setting source to its sender
+  int Probe(int from_proc, int tag, int &source)
   {
-    return MPI_Send(MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), to_proc, 0, MPIComm);
+    MPI_Status status;
+    int mpi_status = MPI_Probe(from_proc, tag, MPIComm, &status);
+    source = status.MPI_SOURCE;
+    return mpi_status;
   }
 
-  // Receive
-  template<class T>
-  inline int Receive(int from_proc, T &val)
+  /// Whether a message from from_proc with tag is waiting, setting source to its sender
+  bool IProbe(int from_proc, int tag, int &source)
   {
-    return MPI_Recv(MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), from_proc, 0, MPIComm, MPI_STATUS_IGNORE);
+    MPI_Status status;
+    int flag;
+    MPI_Iprobe(from_proc, tag, MPIComm, &flag, &status);
+    if (flag)
+      source = status.MPI_SOURCE;
+    return flag;
   }
 
-  // Sendrecv
+  // Send (composite types go serialized, see serialize.h)
   template<class T>
-  inline int SendReceive (int from_proc, T &from_buff, int to_proc, T &to_buff)
-  {
-    return MPI_Sendrecv(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), from_proc, 1, MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(to_buff), MPITypeTraits<T>::GetType(to_buff), to_proc, 1, MPIComm, MPI_STATUS_IGNORE);
-  }
+  inline int Send(int to_proc, T &val, int tag=0) { return Send(to_proc, val, tag, HasMPIType<T>()); }
 
-  // Broadcast
   template<class T>
-  inline int Broadcast(int from_proc, T &val)
+  inline int Send(int to_proc, T &val, int tag, std::true_type)
   {
-    return MPI_Bcast(MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), from_proc, MPIComm);
+    SCAFFOLD_COMM_PROFILE(COMM_SEND, CommBytes(val));
+    size_t size = MPITypeTraits<T>::GetSize(val);
+    void* addr = MPITypeTraits<T>::GetAddr(val);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(val);
+    if (size <= MaxCount())
+      return MPI_Send(addr, size, type, to_proc, tag, MPIComm);
+    return Pipeline(size, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Isend(ChunkAddr(addr,offset,type), count, type, to_proc, tag, MPIComm, request);
+    });
   }
 
-  // Reduce
   template<class T>
-  inline int Reduce(int to_proc, T &from_buff, T &to_buff, MPI_Op Op)
+  int Send(int to_proc, T &val, int tag, std::false_type)
   {
-    return MPI_Reduce(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), Op, to_proc, MPIComm);
+    PooledBuffer packed;
+    Pack(val, packed.buff);
+    SCAFFOLD_COMM_PROFILE(COMM_SEND, packed.buff.size());
+    if (packed.buff.size() > INT_MAX) {
+      std::cerr << "ERROR: Serialized message exceeds INT_MAX bytes!" << std::endl;
+      abort();
+    }
+    return MPI_Send(packed.buff.data(), packed.buff.size(), MPI_BYTE, to_proc, tag, MPIComm);
   }
 
-  // AllReduce
+  // Receive (composite types are resized to fit)
   template<class T>
-  inline int AllReduce(T &from_buff, T &to_buff, MPI_Op Op)
+  inline int Receive(int from_proc, T &val, int tag=0) { return Receive(from_proc, val, tag, HasMPIType<T>()); }
+
+  template<class T>
+  inline int Receive(int from_proc, T &val, int tag, std::true_type)
   {
-    return MPI_Allreduce(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), Op, MPIComm);
+    SCAFFOLD_COMM_PROFILE(COMM_RECEIVE, CommBytes(val));
+    size_t size = MPITypeTraits<T>::GetSize(val);
+    void* addr = MPITypeTraits<T>::GetAddr(val);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(val);
+    if (size <= MaxCount())
+      return MPI_Recv(addr, size, type, from_proc, tag, MPIComm, MPI_STATUS_IGNORE);
+    return Pipeline(size, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Irecv(ChunkAddr(addr,offset,type), count, type, from_proc, tag, MPIComm, request);
+    });
   }
 
-  // Sum
   template<class T>
-  inline int Sum(int to_proc, T &from_buff, T &to_buff) { return Reduce(to_proc,from_buff,to_buff,MPI_SUM); }
+  int Receive(int from_proc, T &val, int tag, std::false_type)
+  {
+    MPI_Message message;
+    MPI_Status status;
+    MPI_Mprobe(from_proc, tag, MPIComm, &message, &status);
+    int size;
+    MPI_Get_count(&status, MPI_BYTE, &size);
+    SCAFFOLD_COMM_PROFILE(COMM_RECEIVE, size);
+    PooledBuffer packed;
+    packed.buff.resize(size);
+    int mpi_status = MPI_Mrecv(packed.buff.data(), size, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+    Unpack(packed.buff, val);
+    return mpi_status;
+  }
 
-  // AllSum
+  /** Receives a message of unknown length, resizing val to fit it first
+   * (see ResizeToCount), so no separate size message is needed. Matches the
+   * message with a matched probe, so it is safe with other threads receiving.
+   * Messages must fit in one send (up to MaxCount() elements); composite types
+   * are resized by Receive already.
+   * @param from_proc Sending process, or MPI_ANY_SOURCE
+   * @param val Buffer, resized to the message
+   * @param tag Message tag, or MPI_ANY_TAG
+   * return the MPI status
+   */
   template<class T>
-  inline int AllSum(T &from_buff, T &to_buff) { return AllReduce(from_buff,to_buff,MPI_SUM); }
+  inline int ReceiveResize(int from_proc, T &val, int tag=0) { return ReceiveResize(from_proc, val, tag, HasMPIType<T>()); }
 
-  // Product
   template<class T>
-  inline int Product(int to_proc, T &from_buff, T &to_buff) { return Reduce(to_proc,from_buff,to_buff,MPI_PROD); }
+  int ReceiveResize(int from_proc, T &val, int tag, std::true_type)
+  {
+    MPI_Message message;
+    MPI_Status status;
+    MPI_Mprobe(from_proc, tag, MPIComm, &message, &status);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(val);
+    int count;
+    MPI_Get_count(&status, type, &count);
+    if ((count == MPI_UNDEFINED) || !ResizeToCount(val, count)) {
+      std::cerr << "ERROR: Received message does not fit the receive type!" << std::endl;
+      abort();
+    }
+    SCAFFOLD_COMM_PROFILE(COMM_RECEIVE, CommBytes(val));
+    return MPI_Mrecv(MPITypeTraits<T>::GetAddr(val), count, type, &message, MPI_STATUS_IGNORE);
+  }
 
-  // AllProduct
   template<class T>
-  inline int AllProduct(T &from_buff, T &to_buff) { return AllReduce(from_buff,to_buff,MPI_PROD); }
+  inline int ReceiveResize(int from_proc, T &val, int tag, std::false_type) { return Receive(from_proc, val, tag, std::false_type()); }
 
-  // Gather
+  // Sendrecv
   template<class T>
-  inline int Gather(int to_proc, T &from_buff, T &to_buff)
+  inline int SendReceive (int from_proc, T &from_buff, int to_proc, T &to_buff)
   {
-    return MPI_Gather(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(to_buff), to_proc, MPIComm);
+    SCAFFOLD_COMM_PROFILE(COMM_SENDRECEIVE, CommBytes(from_buff) + CommBytes(to_buff));
+    size_t from_size = MPITypeTraits<T>::GetSize(from_buff);
+    size_t to_size = MPITypeTraits<T>::GetSize(to_buff);
+    if ((from_size <= MaxCount()) && (to_size <= MaxCount()))
+      return MPI_Sendrecv(MPITypeTraits<T>::GetAddr(from_buff), from_size, MPITypeTraits<T>::GetType(from_buff), from_proc, 1, MPITypeTraits<T>::GetAddr(to_buff), to_size, MPITypeTraits<T>::GetType(to_buff), to_proc, 1, MPIComm, MPI_STATUS_IGNORE);
+    void* from_addr = MPITypeTraits<T>::GetAddr(from_buff);
+    void* to_addr = MPITypeTraits<T>::GetAddr(to_buff);
+    MPI_Datatype from_type = MPITypeTraits<T>::GetType(from_buff);
+    MPI_Datatype to_type = MPITypeTraits<T>::GetType(to_buff);
+    std::vector<MPI_Request> requests;
+    StartChunks(to_size, requests, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Irecv(ChunkAddr(to_addr,offset,to_type), count, to_type, to_proc, 1, MPIComm, request);
+    });
+    StartChunks(from_size, requests, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Isend(ChunkAddr(from_addr,offset,from_type), count, from_type, from_proc, 1, MPIComm, request);
+    });
+    return MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
   }
 
-  // Gatherv
-  template<class T>
-  inline int Gatherv(int to_proc, T &from_buff, T &to_buff, int* recvCounts, int* displacements)
+  /// Default algorithm of Broadcast
+  static BroadcastAlgorithm& BroadcastAlgo()
   {
-     return MPI_Gatherv(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), recvCounts, displacements, MPITypeTraits<T>::GetType(to_buff), to_proc, MPIComm);
+    static BroadcastAlgorithm algo = BCAST_AUTO;
+    return algo;
   }
 
-  // GatherCols
-  template<class T>
-  int GatherCols(int to_proc, T &from_buff, T &to_buff)
+  /// Messages from this many bytes up count as large for BCAST_AUTO
+  static size_t& LargeBroadcastBytes()
   {
-    int n_procs = NumProcs();
-    int my_proc = MyProc();
-#ifdef USE_ARMADILLO
-    int rows = from_buff.n_rows;
-    int cols = from_buff.n_cols;
-#elif defined USE_EIGEN
-    int rows = from_buff.rows();
-    int cols = from_buff.cols();
-#endif
-    int displacements[n_procs];
-    int recvCounts[n_procs];
-    int curr_col = 0;
-    for (int proc=0; proc<n_procs; proc++) {
-      int proc_cols = cols/n_procs + ((cols%n_procs)>proc);
-      displacements[proc] = rows*curr_col;
-      recvCounts[proc] = rows*proc_cols;
-      if (proc == my_proc) {
-        to_buff.set_size(rows,proc_cols);
-      }
-      curr_col += proc_cols;
-    }
-    return Gather(to_proc, from_buff, to_buff, recvCounts, displacements);
+    static size_t large_bytes = 1<<19;
+    return large_bytes;
   }
 
-  // AllGather
-  template<class T>
-  inline int AllGather(T &from_buff, T &to_buff)
+  /// Measured choices for BCAST_AUTO: the algorithm of the last entry whose
+  /// byte count a message reaches (see comm_tuning.h). Empty uses LargeBroadcastBytes().
+  static std::vector< std::pair<size_t, BroadcastAlgorithm> >& BroadcastTable()
   {
-    return MPI_Gather(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(to_buff), MPIComm);
+    static std::vector< std::pair<size_t, BroadcastAlgorithm> > table;
+    return table;
   }
 
-  // Scatter
+  // Broadcast (composite types go serialized, see serialize.h)
   template<class T>
-  inline int Scatter(int from_proc, T &from_buff, T &to_buff)
+  inline int Broadcast(int from_proc, T &val, BroadcastAlgorithm algo=BroadcastAlgo()) { return Broadcast(from_proc, val, algo, HasMPIType<T>()); }
+
+  template<class T>
+  inline int Broadcast(int from_proc, T &val, BroadcastAlgorithm algo, std::true_type)
   {
-    return MPI_Scatter(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(to_buff), MPITypeTraits<T>::GetType(to_buff), from_proc, MPIComm);
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_BROADCAST, CommBytes(val), MPIComm);
+    return BroadcastBuffer(from_proc, MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), algo);
   }
 
-  // Scatter
+  // Sends the packed size, then the bytes
   template<class T>
-  inline int Scatterv(int from_proc, T &from_buff, T &to_buff, int* send_counts, int* displacements)
+  int Broadcast(int from_proc, T &val, BroadcastAlgorithm algo, std::false_type)
   {
-     return MPI_Scatterv(MPITypeTraits<T>::GetAddr(from_buff), send_counts, displacements, MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(to_buff), MPITypeTraits<T>::GetType(to_buff), from_proc, MPIComm);
+    PooledBuffer packed;
+    unsigned long size = 0;
+    if (MyProc() == from_proc) {
+      Pack(val, packed.buff);
+      size = packed.buff.size();
+    }
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_BROADCAST, size, MPIComm);
+    MPI_Bcast(&size, 1, MPI_UNSIGNED_LONG, from_proc, MPIComm);
+    packed.buff.resize(size);
+    int status = BroadcastBuffer(from_proc, packed.buff.data(), size, MPI_BYTE, algo);
+    if (MyProc() != from_proc)
+      Unpack(packed.buff, val);
+    return status;
   }
 
-  // ScatterCols
-  template<class T>
-  int ScatterCols(int from_proc, T &from_buff, T &to_buff)
+  /** Broadcasts size elements of type at addr with algo. Every process
+   * must pass the same size and algorithm.
+   * return the MPI status
+   */
+  int BroadcastBuffer(int from_proc, void* addr, size_t size, MPI_Datatype type, BroadcastAlgorithm algo=BroadcastAlgo())
   {
     int n_procs = NumProcs();
-    int my_proc = MyProc();
-#ifdef USE_ARMADILLO
-    int rows = from_buff.n_rows;
-    int cols = from_buff.n_cols;
-#elif defined USE_EIGEN
-    int rows = from_buff.rows();
-    int cols = from_buff.cols();
-#endif
-    int displacements[n_procs];
-    int send_counts[n_procs];
-    int curr_col = 0;
-    for (int proc=0; proc<n_procs; proc++) {
-      int proc_cols = cols/n_procs + ((cols%n_procs)>proc);
-      displacements[proc] = rows*curr_col;
-      send_counts[proc] = rows*proc_cols;
-      if (proc == my_proc) {
-        to_buff.set_size(rows,proc_cols);
+    if (algo == BCAST_AUTO) {
+      int type_size;
+      MPI_Type_size(type, &type_size);
+      size_t bytes = size*type_size;
+      if (BroadcastTable().empty()) {
+        if ((n_procs <= 2) || (bytes < LargeBroadcastBytes()))
+          algo = BCAST_NATIVE;
+        else if ((size >= size_t(n_procs)) && (size <= MaxCount()))
+          algo = BCAST_SCATTER_ALLGATHER;
+        else
+          algo = BCAST_CHAIN;
       }
-      curr_col += proc_cols;
+      for (auto &entry: BroadcastTable())
+        if (bytes >= entry.first)
+          algo = entry.second;
+    }
+    if ((algo == BCAST_SCATTER_ALLGATHER) && ((size < size_t(n_procs)) || (size > MaxCount())))
+      algo = BCAST_CHAIN; // Blocks must be nonempty, with int displacements
+    switch (algo) {
+      case BCAST_BINOMIAL:
+        return BroadcastBinomial(from_proc, addr, size, type);
+      case BCAST_CHAIN:
+        return BroadcastChain(from_proc, addr, size, type);
+      case BCAST_SCATTER_ALLGATHER:
+        return BroadcastScatterAllgather(from_proc, addr, size, type);
+      default:
+        if (size <= MaxCount())
+          return MPI_Bcast(addr, size, type, from_proc, MPIComm);
+        return Pipeline(size, [&](size_t offset, int count, MPI_Request *request) {
+          MPI_Ibcast(ChunkAddr(addr,offset,type), count, type, from_proc, MPIComm, request);
+        });
     }
-    return Scatterv(from_proc, from_buff, to_buff, send_counts, displacements);
   }
 
-#else   // Serial version
-  inline void SetWorld(){}
-  inline int MyProc() {return 0;}
-  inline int NumProcs() {return 1;}
-  inline std::string MyHost() {return "0";}
-  inline void BarrierSync() {}
-  inline void Split(int color, Communicator &new_comm) {}
-  inline void Subset(matrix::vec<int> &ranks, Communicator &new_comm)
+  // Tag of the point-to-point messages of the broadcast algorithms
+  enum { BROADCAST_TAG = 7601 };
+
+  // Binomial tree over ranks relative to from_proc, chunk by chunk past MaxCount()
+  int BroadcastBinomial(int from_proc, void* addr, size_t size, MPI_Datatype type)
   {
-    if (ranks.size() != 1) {
-      std::cerr << "Serial verion of code does not support nontrivial subsets. Exiting.\n";
-      abort();
+    int n_procs = NumProcs();
+    int rel = (MyProc() - from_proc + n_procs) % n_procs;
+    int status = MPI_SUCCESS;
+    for (size_t offset=0; offset<size; offset+=MaxCount()) {
+      void* chunk = ChunkAddr(addr, offset, type);
+      int count = std::min(MaxCount(), size-offset);
+      int mask = 1;
+      for (; mask<n_procs; mask<<=1)
+        if (rel & mask) {
+          status = MPI_Recv(chunk, count, type, (rel-mask+from_proc) % n_procs, BROADCAST_TAG, MPIComm, MPI_STATUS_IGNORE);
+          break;
+        }
+      for (mask>>=1; mask>0; mask>>=1)
+        if (rel+mask < n_procs)
+          status = MPI_Send(chunk, count, type, (rel+mask+from_proc) % n_procs, BROADCAST_TAG, MPIComm);
     }
+    return status;
   }
 
+  /// Chain from_proc, from_proc+1, ... in segments of SegmentSize() elements:
+  /// each process forwards a segment as soon as it arrives, with up to
+  /// PipelineDepth() segments being received ahead
+  int BroadcastChain(int from_proc, void* addr, size_t size, MPI_Datatype type)
+  {
+    int n_procs = NumProcs();
+    int my_proc = MyProc();
+    int rel = (my_proc - from_proc + n_procs) % n_procs;
+    int prev = (my_proc - 1 + n_procs) % n_procs, next = (my_proc + 1) % n_procs;
+    size_t segment_size = std::max(size_t(1), std::min(SegmentSize(), MaxCount()));
+    size_t n_segments = (size + segment_size - 1)/segment_size;
+    size_t depth = std::max(1, PipelineDepth());
+    std::vector<MPI_Request> recv_requests(n_segments, MPI_REQUEST_NULL), send_requests(n_segments, MPI_REQUEST_NULL);
+    auto post_recv = [&](size_t i) {
+      if ((rel > 0) && (i < n_segments))
+        MPI_Irecv(ChunkAddr(addr,i*segment_size,type), std::min(segment_size, size-i*segment_size), type, prev, BROADCAST_TAG, MPIComm, &recv_requests[i]);
+    };
+    for (size_t i=0; i<depth; ++i)
+      post_recv(i);
+    for (size_t i=0; i<n_segments; ++i) {
+      MPI_Wait(&recv_requests[i], MPI_STATUS_IGNORE);
+      post_recv(i+depth);
+      if (rel < n_procs-1)
+        MPI_Isend(ChunkAddr(addr,i*segment_size,type), std::min(segment_size, size-i*segment_size), type, next, BROADCAST_TAG, MPIComm, &send_requests[i]);
+    }
+    return MPI_Waitall(send_requests.size(), send_requests.data(), MPI_STATUSES_IGNORE);
+  }
+
+  /// Scatters one block to each process, then all-gathers the blocks, so the
+  /// root sends each byte once (van de Geijn); needs size in [NumProcs(), MaxCount()]
+  int BroadcastScatterAllgather(int from_proc, void* addr, size_t size, MPI_Datatype type)
+  {
+    int n_procs = NumProcs();
+    int my_proc = MyProc();
+    std::vector<int> counts(n_procs), displacements(n_procs);
+    for (int proc=0; proc<n_procs; ++proc)
+      ColBlock(size, proc, n_procs, displacements[proc], counts[proc]);
+    void* my_block = ChunkAddr(addr, displacements[my_proc], type);
+    MPI_Scatterv(addr, counts.data(), displacements.data(), type,
+                 my_proc == from_proc ? MPI_IN_PLACE : my_block, counts[my_proc], type, from_proc, MPIComm);
+    return MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, addr, counts.data(), displacements.data(), type, MPIComm);
+  }
+
+  // Reduce
   template<class T>
-  inline int Send(int to_proc, T &val) {}
-  template<class T>
-  inline int Receive(int from_proc, T &val) {}
+  inline int Reduce(int to_proc, T &from_buff, T &to_buff, MPI_Op Op)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_REDUCE, CommBytes(from_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(from_buff);
+    void* from_addr = MPITypeTraits<T>::GetAddr(from_buff);
+    void* to_addr = MPITypeTraits<T>::GetAddr(to_buff);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(from_buff);
+    if (size <= MaxCount())
+      return MPI_Reduce(from_addr, to_addr, size, type, Op, to_proc, MPIComm);
+    return Pipeline(size, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Ireduce(ChunkAddr(from_addr,offset,type), ChunkAddr(to_addr,offset,type), count, type, Op, to_proc, MPIComm, request);
+    });
+  }
+
+  // AllReduce
+  template<class T>
+  inline int AllReduce(T &from_buff, T &to_buff, MPI_Op Op)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_ALLREDUCE, CommBytes(from_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(from_buff);
+    void* from_addr = MPITypeTraits<T>::GetAddr(from_buff);
+    void* to_addr = MPITypeTraits<T>::GetAddr(to_buff);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(from_buff);
+    if (size <= MaxCount())
+      return MPI_Allreduce(from_addr, to_addr, size, type, Op, MPIComm);
+    return Pipeline(size, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Iallreduce(ChunkAddr(from_addr,offset,type), ChunkAddr(to_addr,offset,type), count, type, Op, MPIComm, request);
+    });
+  }
+
+  // Reduce with a functor (see reduce_op.h)
+  template<class T, class F>
+  inline int Reduce(int to_proc, T &from_buff, T &to_buff, F op) { CheckReduceOp<F,T>(); return Reduce(to_proc,from_buff,to_buff,UserOp<F>::Get()); }
+
+  // AllReduce with a functor (see reduce_op.h)
+  template<class T, class F>
+  inline int AllReduce(T &from_buff, T &to_buff, F op) { CheckReduceOp<F,T>(); return AllReduce(from_buff,to_buff,UserOp<F>::Get()); }
+
+  // Scan (inclusive prefix reduction over processes 0,...,MyProc())
+  template<class T>
+  inline int Scan(T &from_buff, T &to_buff, MPI_Op Op)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_SCAN, CommBytes(from_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(from_buff);
+    void* from_addr = MPITypeTraits<T>::GetAddr(from_buff);
+    void* to_addr = MPITypeTraits<T>::GetAddr(to_buff);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(from_buff);
+    if (size <= MaxCount())
+      return MPI_Scan(from_addr, to_addr, size, type, Op, MPIComm);
+    return Pipeline(size, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Iscan(ChunkAddr(from_addr,offset,type), ChunkAddr(to_addr,offset,type), count, type, Op, MPIComm, request);
+    });
+  }
+
+  // ExScan (exclusive prefix reduction over processes 0,...,MyProc()-1, to_buff untouched on process 0)
+  template<class T>
+  inline int ExScan(T &from_buff, T &to_buff, MPI_Op Op)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_EXSCAN, CommBytes(from_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(from_buff);
+    void* from_addr = MPITypeTraits<T>::GetAddr(from_buff);
+    void* to_addr = MPITypeTraits<T>::GetAddr(to_buff);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(from_buff);
+    if (size <= MaxCount())
+      return MPI_Exscan(from_addr, to_addr, size, type, Op, MPIComm);
+    return Pipeline(size, [&](size_t offset, int count, MPI_Request *request) {
+      MPI_Iexscan(ChunkAddr(from_addr,offset,type), ChunkAddr(to_addr,offset,type), count, type, Op, MPIComm, request);
+    });
+  }
+
+  // Scan with a functor (see reduce_op.h)
+  template<class T, class F>
+  inline int Scan(T &from_buff, T &to_buff, F op) { CheckReduceOp<F,T>(); return Scan(from_buff,to_buff,UserOp<F>::Get()); }
+
+  // ExScan with a functor (see reduce_op.h)
+  template<class T, class F>
+  inline int ExScan(T &from_buff, T &to_buff, F op) { CheckReduceOp<F,T>(); return ExScan(from_buff,to_buff,UserOp<F>::Get()); }
+
+  // ScanSum
+  template<class T>
+  inline int ScanSum(T &from_buff, T &to_buff) { return Scan(from_buff,to_buff,MPI_SUM); }
+
+  // ExScanSum
+  template<class T>
+  inline int ExScanSum(T &from_buff, T &to_buff) { return ExScan(from_buff,to_buff,MPI_SUM); }
+
+  /** Offset of this process's share in a buffer concatenating every process's share
+   * in process order, with the buffer's total size, from one overlapped scan and sum
+   * @param local Size of this process's share
+   * @param offset Sum of the sizes on lower processes (0 on process 0)
+   * @param total Sum of the sizes on all processes
+   * return the MPI status
+   */
+  template<class T>
+  int GlobalOffset(T local, T &offset, T &total)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_EXSCAN, 2.*CommBytes(local), MPIComm);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(local);
+    MPI_Request requests[2];
+    MPI_Iexscan(&local, &offset, 1, type, MPI_SUM, MPIComm, &requests[0]);
+    MPI_Iallreduce(&local, &total, 1, type, MPI_SUM, MPIComm, &requests[1]);
+    int status = MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+    if (MyProc() == 0)
+      offset = T(0);
+    return status;
+  }
+
+  // Sum
+  template<class T>
+  inline int Sum(int to_proc, T &from_buff, T &to_buff) { return Reduce(to_proc,from_buff,to_buff,MPI_SUM); }
+
+  // AllSum
+  template<class T>
+  inline int AllSum(T &from_buff, T &to_buff) { return AllReduce(from_buff,to_buff,MPI_SUM); }
+
+  // Product
+  template<class T>
+  inline int Product(int to_proc, T &from_buff, T &to_buff) { return Reduce(to_proc,from_buff,to_buff,MPI_PROD); }
+
+  // AllProduct
+  template<class T>
+  inline int AllProduct(T &from_buff, T &to_buff) { return AllReduce(from_buff,to_buff,MPI_PROD); }
+
+  /// Elements per segment of the pipelined reductions and chain broadcasts
+  static size_t& SegmentSize()
+  {
+    static size_t segment_size = 1<<16;
+    return segment_size;
+  }
+
+  /// Segments of a pipelined reduction or chain broadcast in flight at once
+  static int& PipelineDepth()
+  {
+    static int pipeline_depth = 4;
+    return pipeline_depth;
+  }
+
+  /** Reduces a buffer in segments of SegmentSize() elements, keeping up to
+   * PipelineDepth() non-blocking reductions in flight, so the combining of
+   * one segment overlaps with the transfer of the next
+   * @param to_proc ID for receiving process, or -1 to reduce onto all
+   * return the MPI status
+   */
+  template<class T>
+  int PipelinedReduce(int to_proc, T &from_buff, T &to_buff, MPI_Op Op)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(to_proc < 0 ? COMM_ALLREDUCE : COMM_REDUCE, CommBytes(from_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(from_buff);
+    void* from_addr = MPITypeTraits<T>::GetAddr(from_buff);
+    void* to_addr = MPITypeTraits<T>::GetAddr(to_buff);
+    MPI_Datatype type = MPITypeTraits<T>::GetType(from_buff);
+    size_t segment_size = std::max(size_t(1), std::min(SegmentSize(), MaxCount()));
+    int depth = std::max(1, PipelineDepth());
+    std::vector<MPI_Request> requests(depth, MPI_REQUEST_NULL);
+    int status = MPI_SUCCESS;
+    size_t n_segments = (size + segment_size - 1)/segment_size;
+    for (size_t segment=0; segment<n_segments; ++segment) {
+      MPI_Request &request = requests[segment%depth];
+      if (request != MPI_REQUEST_NULL)
+        status = MPI_Wait(&request, MPI_STATUS_IGNORE);
+      size_t offset = segment*segment_size;
+      int count = std::min(segment_size, size-offset);
+      if (to_proc < 0)
+        MPI_Iallreduce(ChunkAddr(from_addr,offset,type), ChunkAddr(to_addr,offset,type), count, type, Op, MPIComm, &request);
+      else
+        MPI_Ireduce(ChunkAddr(from_addr,offset,type), ChunkAddr(to_addr,offset,type), count, type, Op, to_proc, MPIComm, &request);
+    }
+    int wait_status = MPI_Waitall(depth, requests.data(), MPI_STATUSES_IGNORE);
+    return status != MPI_SUCCESS ? status : wait_status;
+  }
+
+  // PipelinedAllReduce
+  template<class T>
+  inline int PipelinedAllReduce(T &from_buff, T &to_buff, MPI_Op Op) { return PipelinedReduce(-1,from_buff,to_buff,Op); }
+
+  // PipelinedSum
+  template<class T>
+  inline int PipelinedSum(int to_proc, T &from_buff, T &to_buff) { return PipelinedReduce(to_proc,from_buff,to_buff,MPI_SUM); }
+
+  // PipelinedAllSum
+  template<class T>
+  inline int PipelinedAllSum(T &from_buff, T &to_buff) { return PipelinedReduce(-1,from_buff,to_buff,MPI_SUM); }
+
+  // Gather
+  template<class T>
+  inline int Gather(int to_proc, T &from_buff, T &to_buff)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_GATHER, CommBytes(from_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(from_buff);
+    if (size <= MaxCount())
+      return MPI_Gather(MPITypeTraits<T>::GetAddr(from_buff), size, MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), size, MPITypeTraits<T>::GetType(to_buff), to_proc, MPIComm);
+    MPI_Datatype type = LargeType(size, MPITypeTraits<T>::GetType(from_buff));
+    int status = MPI_Gather(MPITypeTraits<T>::GetAddr(from_buff), 1, type, MPITypeTraits<T>::GetAddr(to_buff), 1, type, to_proc, MPIComm);
+    MPI_Type_free(&type);
+    return status;
+  }
+
+  // Gatherv (counts and displacements are MPI's ints, so each process sends at most INT_MAX elements)
+  template<class T>
+  inline int Gatherv(int to_proc, T &from_buff, T &to_buff, int* recvCounts, int* displacements)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_GATHERV, CommBytes(from_buff), MPIComm);
+    CheckIntCount(MPITypeTraits<T>::GetSize(from_buff), "Gatherv");
+    return MPI_Gatherv(MPITypeTraits<T>::GetAddr(from_buff), MPITypeTraits<T>::GetSize(from_buff), MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), recvCounts, displacements, MPITypeTraits<T>::GetType(to_buff), to_proc, MPIComm);
+  }
+
+  /** Gathers a different number of elements from every process, exchanging
+   * the counts first unless counts already holds them
+   * @param to_proc Process receiving the elements
+   * @param from_buff This process's elements
+   * @param to_buff All elements in process order, resized (on to_proc)
+   * @param counts Counts and offsets of every process's elements (on to_proc)
+   * return the MPI status
+   */
+  template<class T>
+  inline int Gatherv(int to_proc, matrix::vec<T> &from_buff, matrix::vec<T> &to_buff, GathervCounts &counts)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_GATHERV, CommBytes(from_buff), MPIComm);
+    ExchangeCounts(to_proc, from_buff.size(), counts);
+    if (MyProc() == to_proc)
+      to_buff.set_size(counts.Total());
+    return GathervBuffer(to_proc, VarAddr(from_buff), VarAddr(to_buff), VarType(from_buff), counts);
+  }
+
+  template<class T>
+  inline int Gatherv(int to_proc, std::vector<T> &from_buff, std::vector<T> &to_buff, GathervCounts &counts)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_GATHERV, from_buff.size()*sizeof(T), MPIComm);
+    ExchangeCounts(to_proc, from_buff.size(), counts);
+    if (MyProc() == to_proc)
+      to_buff.resize(counts.Total());
+    return GathervBuffer(to_proc, VarAddr(from_buff), VarAddr(to_buff), VarType(from_buff), counts);
+  }
+
+  // Gatherv, returning the offset of each process's elements (then the total) on to_proc
+  template<class V>
+  inline int Gatherv(int to_proc, V &from_buff, V &to_buff, std::vector<int> &offsets)
+  {
+    GathervCounts counts;
+    int status = Gatherv(to_proc, from_buff, to_buff, counts);
+    offsets.swap(counts.offsets);
+    return status;
+  }
+
+  // AllGatherv (as Gatherv, with the elements and counts on every process)
+  template<class T>
+  inline int AllGatherv(matrix::vec<T> &from_buff, matrix::vec<T> &to_buff, GathervCounts &counts)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_ALLGATHERV, CommBytes(from_buff), MPIComm);
+    ExchangeCounts(-1, from_buff.size(), counts);
+    to_buff.set_size(counts.Total());
+    return GathervBuffer(-1, VarAddr(from_buff), VarAddr(to_buff), VarType(from_buff), counts);
+  }
+
+  template<class T>
+  inline int AllGatherv(std::vector<T> &from_buff, std::vector<T> &to_buff, GathervCounts &counts)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_ALLGATHERV, from_buff.size()*sizeof(T), MPIComm);
+    ExchangeCounts(-1, from_buff.size(), counts);
+    to_buff.resize(counts.Total());
+    return GathervBuffer(-1, VarAddr(from_buff), VarAddr(to_buff), VarType(from_buff), counts);
+  }
+
+  // AllGatherv, returning the offset of each process's elements, then the total
+  template<class V>
+  inline int AllGatherv(V &from_buff, V &to_buff, std::vector<int> &offsets)
+  {
+    GathervCounts counts;
+    int status = AllGatherv(from_buff, to_buff, counts);
+    offsets.swap(counts.offsets);
+    return status;
+  }
+
+  // GatherCols
+  template<class T>
+  int GatherCols(int to_proc, T &from_buff, T &to_buff)
+  {
+    int n_procs = NumProcs();
+    int my_proc = MyProc();
+#ifdef USE_ARMADILLO
+    int rows = from_buff.n_rows;
+    int cols = from_buff.n_cols;
+#elif defined USE_EIGEN
+    int rows = from_buff.rows();
+    int cols = from_buff.cols();
+#endif
+    int displacements[n_procs];
+    int recvCounts[n_procs];
+    int curr_col = 0;
+    for (int proc=0; proc<n_procs; proc++) {
+      int proc_cols = cols/n_procs + ((cols%n_procs)>proc);
+      displacements[proc] = rows*curr_col;
+      recvCounts[proc] = rows*proc_cols;
+      if (proc == my_proc) {
+        to_buff.set_size(rows,proc_cols);
+      }
+      curr_col += proc_cols;
+    }
+    return Gather(to_proc, from_buff, to_buff, recvCounts, displacements);
+  }
+
+  // AllGather
+  template<class T>
+  inline int AllGather(T &from_buff, T &to_buff)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_ALLGATHER, CommBytes(from_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(from_buff);
+    if (size <= MaxCount())
+      return MPI_Allgather(MPITypeTraits<T>::GetAddr(from_buff), size, MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), size, MPITypeTraits<T>::GetType(to_buff), MPIComm);
+    MPI_Datatype type = LargeType(size, MPITypeTraits<T>::GetType(from_buff));
+    int status = MPI_Allgather(MPITypeTraits<T>::GetAddr(from_buff), 1, type, MPITypeTraits<T>::GetAddr(to_buff), 1, type, MPIComm);
+    MPI_Type_free(&type);
+    return status;
+  }
+
+  // Scatter
+  template<class T>
+  inline int Scatter(int from_proc, T &from_buff, T &to_buff)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_SCATTER, CommBytes(to_buff), MPIComm);
+    size_t size = MPITypeTraits<T>::GetSize(to_buff);
+    if (size <= MaxCount())
+      return MPI_Scatter(MPITypeTraits<T>::GetAddr(from_buff), size, MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), size, MPITypeTraits<T>::GetType(to_buff), from_proc, MPIComm);
+    MPI_Datatype type = LargeType(size, MPITypeTraits<T>::GetType(to_buff));
+    int status = MPI_Scatter(MPITypeTraits<T>::GetAddr(from_buff), 1, type, MPITypeTraits<T>::GetAddr(to_buff), 1, type, from_proc, MPIComm);
+    MPI_Type_free(&type);
+    return status;
+  }
+
+  // Scatterv (counts and displacements are MPI's ints, so each process receives at most INT_MAX elements)
+  template<class T>
+  inline int Scatterv(int from_proc, T &from_buff, T &to_buff, int* send_counts, int* displacements)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_SCATTERV, CommBytes(to_buff), MPIComm);
+    CheckIntCount(MPITypeTraits<T>::GetSize(to_buff), "Scatterv");
+    return MPI_Scatterv(MPITypeTraits<T>::GetAddr(from_buff), send_counts, displacements, MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), MPITypeTraits<T>::GetSize(to_buff), MPITypeTraits<T>::GetType(to_buff), from_proc, MPIComm);
+  }
+  /** Sends an equal block of from_buff to every process, in process order
+   * @param from_buff Reference to sending buffer, NumProcs() blocks
+   * @param to_buff Reference to receiving buffer, the same size
+   * return the MPI status
+   */
+  template<class T>
+  inline int Alltoall(T &from_buff, T &to_buff)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_ALLTOALL, CommBytes(from_buff), MPIComm);
+    size_t block = MPITypeTraits<T>::GetSize(from_buff)/NumProcs();
+    if (block <= MaxCount())
+      return MPI_Alltoall(MPITypeTraits<T>::GetAddr(from_buff), block, MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), block, MPITypeTraits<T>::GetType(to_buff), MPIComm);
+    MPI_Datatype type = LargeType(block, MPITypeTraits<T>::GetType(from_buff));
+    int status = MPI_Alltoall(MPITypeTraits<T>::GetAddr(from_buff), 1, type, MPITypeTraits<T>::GetAddr(to_buff), 1, type, MPIComm);
+    MPI_Type_free(&type);
+    return status;
+  }
+
+  /** Sends a block of from_buff of any size to every process. Counts and
+   * displacements are MPI's ints, so each buffer holds at most INT_MAX elements.
+   * @param from_buff Reference to sending buffer
+   * @param send_counts Elements sent to each process
+   * @param send_displacements Offset of each process's block in from_buff
+   * @param to_buff Reference to receiving buffer
+   * @param recv_counts Elements received from each process
+   * @param recv_displacements Offset of each process's block in to_buff
+   * return the MPI status
+   */
+  template<class T>
+  inline int Alltoallv(T &from_buff, int* send_counts, int* send_displacements, T &to_buff, int* recv_counts, int* recv_displacements)
+  {
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_ALLTOALLV, CommBytes(from_buff), MPIComm);
+    CheckIntCount(MPITypeTraits<T>::GetSize(from_buff), "Alltoallv");
+    CheckIntCount(MPITypeTraits<T>::GetSize(to_buff), "Alltoallv");
+    return MPI_Alltoallv(MPITypeTraits<T>::GetAddr(from_buff), send_counts, send_displacements, MPITypeTraits<T>::GetType(from_buff), MPITypeTraits<T>::GetAddr(to_buff), recv_counts, recv_displacements, MPITypeTraits<T>::GetType(to_buff), MPIComm);
+  }
+
+
+  // ScatterCols
+  template<class T>
+  int ScatterCols(int from_proc, T &from_buff, T &to_buff)
+  {
+    int n_procs = NumProcs();
+    int my_proc = MyProc();
+#ifdef USE_ARMADILLO
+    int rows = from_buff.n_rows;
+    int cols = from_buff.n_cols;
+#elif defined USE_EIGEN
+    int rows = from_buff.rows();
+    int cols = from_buff.cols();
+#endif
+    int displacements[n_procs];
+    int send_counts[n_procs];
+    int curr_col = 0;
+    for (int proc=0; proc<n_procs; proc++) {
+      int proc_cols = cols/n_procs + ((cols%n_procs)>proc);
+      displacements[proc] = curr_col;
+      send_counts[proc] = proc_cols;
+      if (proc == my_proc) {
+        to_buff.set_size(rows,proc_cols);
+      }
+      curr_col += proc_cols;
+    }
+    // Count whole columns so large matrices stay within int counts
+    SCAFFOLD_COMM_PROFILE_COLLECTIVE(COMM_SCATTERV, CommBytes(to_buff), MPIComm);
+    MPI_Datatype col_type;
+    MPI_Type_contiguous(rows, MPITypeTraits<T>::GetType(from_buff), &col_type);
+    MPI_Type_commit(&col_type);
+    int status = MPI_Scatterv(MPITypeTraits<T>::GetAddr(from_buff), send_counts, displacements, col_type, MPITypeTraits<T>::GetAddr(to_buff), send_counts[my_proc], col_type, from_proc, MPIComm);
+    MPI_Type_free(&col_type);
+    return status;
+  }
+
+#elif USE_THREAD_COMM // Thread version, see thread_comm.h
+
+  std::shared_ptr<ThreadWorld> world;
+  int proc;
+
+  /// Sets this communicator to be that of all the threads COMM::Launch started
+  /// together with the calling one (just the calling thread outside Launch)
+  void SetWorld()
+  {
+    ThreadRank &rank = CurrentThreadRank();
+    world = rank.world;
+    proc = rank.proc;
+  }
+
+  inline int MyProc() { return proc; }
+  inline int NumProcs() { return world->n_procs; }
+  inline std::string MyHost() { return "0"; }
+  inline void BarrierSync() { world->Barrier(); }
+
+  /// Wildcards of Receive, ReceiveResize and Probe, and the process past a non-periodic Cartesian edge
+  enum { ANY_SOURCE = -1, ANY_TAG = -1, PROC_NULL = -2 };
+
+  /// Fills in the zeros of dims so their product is n_procs, as evenly as possible (like MPI_Dims_create)
+  static void DimsCreate(int n_procs, std::vector<int> &dims)
+  {
+    int rest = n_procs;
+    int n_free = 0;
+    for (auto dim: dims)
+      if (dim > 0)
+        rest /= dim;
+      else
+        ++n_free;
+    if (n_free == 0)
+      return;
+    std::vector<int> factors;
+    for (int factor=2; factor*factor<=rest; ++factor)
+      for (; rest%factor == 0; rest/=factor)
+        factors.push_back(factor);
+    if (rest > 1)
+      factors.push_back(rest);
+    std::vector<int> sizes(n_free, 1);
+    for (auto factor=factors.rbegin(); factor!=factors.rend(); ++factor)
+      *std::min_element(sizes.begin(), sizes.end()) *= *factor;
+    std::sort(sizes.begin(), sizes.end(), std::greater<int>());
+    auto size = sizes.begin();
+    for (auto &dim: dims)
+      if (dim <= 0)
+        dim = *size++;
+  }
+
+  /** Makes new_comm a communicator of the threads passing the same leader
+   * (threads passing -1 get none). Collective over this communicator.
+   * @param leader Process creating the new world, a member of it
+   * @param n_members Processes of the new world
+   * @param new_proc This process's number in it
+   * @param setup Called by the leader on the new world before the others see it
+   */
+  template<class F>
+  void Regroup(int leader, int n_members, int new_proc, Communicator &new_comm, F setup)
+  {
+    std::shared_ptr<ThreadWorld> old_world = world; // new_comm may be this communicator
+    int my_proc = proc;
+    if (my_proc == leader) {
+      old_world->worlds[my_proc] = std::make_shared<ThreadWorld>(n_members);
+      setup(*old_world->worlds[my_proc]);
+    }
+    old_world->Barrier();
+    std::shared_ptr<ThreadWorld> new_world;
+    if (leader >= 0)
+      new_world = old_world->worlds[leader];
+    old_world->Barrier();
+    if (my_proc == leader)
+      old_world->worlds[my_proc].reset();
+    new_comm.world = new_world;
+    new_comm.proc = new_proc;
+  }
+
+  void Split(int color, Communicator &new_comm)
+  {
+    int leader = -1, n_members = 0, new_proc = 0;
+    world->sizes[proc] = color;
+    world->Barrier();
+    for (int p=0; p<NumProcs(); ++p)
+      if (int(world->sizes[p]) == color) {
+        if (leader < 0)
+          leader = p;
+        if (p < proc)
+          ++new_proc;
+        ++n_members;
+      }
+    world->Barrier();
+    Regroup(leader, n_members, new_proc, new_comm, [](ThreadWorld &new_world) {});
+  }
+
+  /// Copy of this communicator with its own message space
+  void Dup(Communicator &new_comm)
+  {
+    std::shared_ptr<ThreadWorld> old_world = world;
+    Regroup(0, NumProcs(), proc, new_comm, [&](ThreadWorld &new_world) {
+      new_world.cart_dims = old_world->cart_dims;
+      new_world.cart_periods = old_world->cart_periods;
+    });
+  }
+
+  /// Releases a communicator created by Split, SplitShared, Dup or Subset
+  void Free() { world.reset(); }
+
+  /// Splits into communicators of the processes sharing a node: all the threads
+  void SplitShared(Communicator &node_comm) { Dup(node_comm); }
+
+  /// Counts calls on this communicator, shared by its copies (see the MPI version)
+  long NextEpoch() { return world->epochs[proc]++; }
+
+  /** Arranges the processes in a Cartesian grid, numbered row-major as in MPI
+   * @param dims Processes along each dimension, with zeros filled in as by MPI_Dims_create
+   * @param periods Whether each dimension wraps around
+   * @param cart_comm Communicator with the grid topology
+   * @param reorder Ignored, threads share one machine
+   */
+  void CartCreate(std::vector<int> &dims, const std::vector<int> &periods, Communicator &cart_comm, bool reorder=false)
+  {
+    DimsCreate(NumProcs(), dims);
+    int n_procs = 1;
+    for (auto dim: dims)
+      n_procs *= dim;
+    if (n_procs != NumProcs()) {
+      std::cerr << "ERROR: Cartesian grid of " << n_procs << " processes on " << NumProcs() << "!" << std::endl;
+      abort();
+    }
+    Regroup(0, n_procs, proc, cart_comm, [&](ThreadWorld &new_world) {
+      new_world.cart_dims = dims;
+      new_world.cart_periods = periods;
+      new_world.cart_periods.resize(dims.size(), 0);
+    });
+  }
+
+  /// Number of dimensions of a Cartesian communicator
+  int CartDims() { return world->cart_dims.size(); }
+
+  /// Processes disp steps down (source) and up (dest) along dim, PROC_NULL past a non-periodic edge
+  void CartShift(int dim, int disp, int &source, int &dest)
+  {
+    std::vector<int> coords;
+    CartCoords(proc, coords);
+    int n = world->cart_dims[dim];
+    int down = coords[dim] - disp;
+    int up = coords[dim] + disp;
+    bool periodic = world->cart_periods[dim];
+    coords[dim] = down;
+    source = (periodic || ((down >= 0) && (down < n))) ? CartRank(coords) : int(PROC_NULL);
+    coords[dim] = up;
+    dest = (periodic || ((up >= 0) && (up < n))) ? CartRank(coords) : int(PROC_NULL);
+  }
+
+  /// Grid coordinates of a process
+  void CartCoords(int cart_proc, std::vector<int> &coords)
+  {
+    coords.resize(CartDims());
+    for (int dim=CartDims()-1; dim>=0; --dim) {
+      coords[dim] = cart_proc%world->cart_dims[dim];
+      cart_proc /= world->cart_dims[dim];
+    }
+  }
+
+  /// Process at grid coordinates (wrapped along every dimension)
+  int CartRank(const std::vector<int> &coords)
+  {
+    int cart_proc = 0;
+    for (int dim=0; dim<CartDims(); ++dim) {
+      int n = world->cart_dims[dim];
+      cart_proc = cart_proc*n + ((coords[dim]%n) + n)%n;
+    }
+    return cart_proc;
+  }
+
+  void Subset(matrix::vec<int> &ranks, Communicator &new_comm)
+  {
+    int leader = -1, new_proc = 0;
+    for (int i=0; i<int(ranks.size()); ++i)
+      if (ranks(i) == proc) {
+        leader = ranks(0);
+        new_proc = i;
+      }
+    Regroup(leader, ranks.size(), new_proc, new_comm, [](ThreadWorld &new_world) {});
+  }
+
+  /** Publishes buffers to the other threads, calls read once every thread has,
+   * and returns once every thread has read
+   * @param ptr Buffer, in world->ptrs[MyProc()]
+   * @param read Copies from the published buffers
+   * @param aux Second buffer, in world->aux
+   * @param size Size, in world->sizes
+   */
+  template<class F>
+  void Exchange(const void* ptr, F read, const void* aux=0, size_t size=0)
+  {
+    world->ptrs[proc] = ptr;
+    world->aux[proc] = aux;
+    world->sizes[proc] = size;
+    world->Barrier();
+    read();
+    world->Barrier();
+  }
+
+  // Bytes of a message, serialized for composite types
+  template<class T>
+  static inline void ToBytes(T &val, std::vector<char> &bytes, std::true_type)
+  {
+    const char* addr = static_cast<const char*>(BufferAddr(val));
+    bytes.assign(addr, addr + BufferBytes(val));
+  }
+  template<class T>
+  static inline void ToBytes(T &val, std::vector<char> &bytes, std::false_type) { Pack(val, bytes); }
+
+  // Copies a message into val, first resizing it to fit if asked (composite types always are)
+  template<class T>
+  static void FromBytes(const std::vector<char> &bytes, T &val, bool resize, std::true_type)
+  {
+    if ((resize && !ResizeToCount(val, bytes.size()/sizeof(typename ElemType<T>::type))) || (bytes.size() > BufferBytes(val))) {
+      std::cerr << "ERROR: Received message does not fit the receive buffer!" << std::endl;
+      abort();
+    }
+    if (!bytes.empty())
+      memcpy(BufferAddr(val), bytes.data(), bytes.size());
+  }
+  template<class T>
+  static inline void FromBytes(const std::vector<char> &bytes, T &val, bool resize, std::false_type) { Unpack(bytes, val); }
+
+  // Send (copied into to_proc's mailbox, so it returns at once; composite types go serialized)
+  template<class T>
+  int Send(int to_proc, T &val, int tag=0)
+  {
+    if (to_proc == PROC_NULL)
+      return 0;
+    ThreadMessage message;
+    message.source = proc;
+    message.tag = tag;
+    ToBytes(val, message.bytes, HasMPIType<T>());
+    world->Post(to_proc, message);
+    return 0;
+  }
+
+  // Receive (from_proc may be ANY_SOURCE and tag ANY_TAG; composite types are resized to fit)
+  template<class T>
+  int Receive(int from_proc, T &val, int tag=0)
+  {
+    if (from_proc == PROC_NULL)
+      return 0;
+    ThreadMessage message;
+    int source;
+    world->Find(proc, from_proc, tag, source, &message, true);
+    FromBytes(message.bytes, val, false, HasMPIType<T>());
+    return 0;
+  }
+
+  // Receive of unknown length, resizing val to the message first (see ResizeToCount)
+  template<class T>
+  int ReceiveResize(int from_proc, T &val, int tag=0)
+  {
+    if (from_proc == PROC_NULL)
+      return 0;
+    ThreadMessage message;
+    int source;
+    world->Find(proc, from_proc, tag, source, &message, true);
+    FromBytes(message.bytes, val, true, HasMPIType<T>());
+    return 0;
+  }
+
+  /// Waits for a message from from_proc with tag (either may be a wildcard) without receiving it, setting source to its sender
+  int Probe(int from_proc, int tag, int &source)
+  {
+    world->Find(proc, from_proc, tag, source, 0, true);
+    return 0;
+  }
+
+  /// Whether a message from from_proc with tag is waiting, setting source to its sender
+  bool IProbe(int from_proc, int tag, int &source) { return world->Find(proc, from_proc, tag, source, 0, false); }
+
+  // SendReceive (the send never waits, so the pair cannot deadlock)
+  template<class T>
+  inline int SendReceive (int from_proc, T &from_buff, int to_proc, T &to_buff)
+  {
+    Send(from_proc, from_buff, 1);
+    return Receive(to_proc, to_buff, 1);
+  }
+
+  // Settings of the MPI version, kept per thread as they are per process there; the thread collectives ignore them
+  static BroadcastAlgorithm& BroadcastAlgo() { static thread_local BroadcastAlgorithm algo = BCAST_AUTO; return algo; }
+  static size_t& LargeBroadcastBytes() { static thread_local size_t large_bytes = 1<<19; return large_bytes; }
+  static std::vector< std::pair<size_t, BroadcastAlgorithm> >& BroadcastTable() { static thread_local std::vector< std::pair<size_t, BroadcastAlgorithm> > table; return table; }
+  static size_t& SegmentSize() { static thread_local size_t segment_size = 1<<16; return segment_size; }
+  static int& PipelineDepth() { static thread_local int pipeline_depth = 4; return pipeline_depth; }
+
+  // Broadcast (every thread copies straight from from_proc's buffer; composite types go serialized)
+  template<class T>
+  inline int Broadcast(int from_proc, T &val, BroadcastAlgorithm algo=BroadcastAlgo()) { return Broadcast(from_proc, val, HasMPIType<T>()); }
+
+  template<class T>
+  int Broadcast(int from_proc, T &val, std::true_type)
+  {
+    Exchange(BufferAddr(val), [&]() {
+      if (proc != from_proc)
+        memcpy(BufferAddr(val), world->ptrs[from_proc], BufferBytes(val));
+    });
+    return 0;
+  }
+
+  template<class T>
+  int Broadcast(int from_proc, T &val, std::false_type)
+  {
+    PooledBuffer packed;
+    if (proc == from_proc)
+      Pack(val, packed.buff);
+    Exchange(&packed.buff, [&]() {
+      if (proc != from_proc)
+        Unpack(*static_cast<const std::vector<char>*>(world->ptrs[from_proc]), val);
+    });
+    return 0;
+  }
+
+  /** Combines the buffers of all threads element-wise, in process order. Each
+   * thread combines one slice into the result (on to_proc, or for all its own),
+   * then for AllReduce copies the other slices.
+   * @param to_proc Process receiving the result, or -1 for all
+   */
+  template<class T, class Op>
+  int ReduceBuffer(int to_proc, T &from_buff, T &to_buff, Op op)
+  {
+    CheckReduceOp<Op,T>();
+    typedef typename Op::value_type V;
+    int n_procs = NumProcs();
+    size_t n = BufferBytes(from_buff)/sizeof(V);
+    world->ptrs[proc] = BufferAddr(from_buff);
+    world->aux[proc] = ((to_proc < 0) || (proc == to_proc)) ? BufferAddr(to_buff) : 0;
+    world->Barrier();
+    V* result = static_cast<V*>(const_cast<void*>(world->aux[to_proc < 0 ? proc : to_proc]));
+    size_t first = proc*(n/n_procs) + std::min(size_t(proc), n%n_procs);
+    size_t last = first + n/n_procs + (n%n_procs > size_t(proc));
+    for (size_t i=first; i<last; ++i) {
+      V val = static_cast<const V*>(world->ptrs[n_procs-1])[i];
+      for (int p=n_procs-2; p>=0; --p)
+        op(static_cast<const V*>(world->ptrs[p])[i], val);
+      result[i] = val;
+    }
+    world->Barrier();
+    if (to_proc < 0) {
+      for (int p=0; p<n_procs; ++p) {
+        size_t p_first = p*(n/n_procs) + std::min(size_t(p), n%n_procs);
+        size_t p_n = n/n_procs + (n%n_procs > size_t(p));
+        if ((p != proc) && (p_n > 0))
+          memcpy(result + p_first, static_cast<const V*>(world->aux[p]) + p_first, p_n*sizeof(V));
+      }
+      world->Barrier();
+    }
+    return 0;
+  }
+
+  // Reduce (element-wise functor, see reduce_op.h)
+  template<class T, class Op>
+  inline int Reduce(int to_proc, T &from_buff, T &to_buff, Op op) { return ReduceBuffer(to_proc, from_buff, to_buff, op); }
+
+  // AllReduce
+  template<class T, class Op>
+  inline int AllReduce(T &from_buff, T &to_buff, Op op) { return ReduceBuffer(-1, from_buff, to_buff, op); }
+
+  // Combines the buffers of the processes up to this one (inclusive) or below it, in process order
+  template<class T, class Op>
+  int ScanBuffer(T &from_buff, T &to_buff, Op op, bool inclusive)
+  {
+    CheckReduceOp<Op,T>();
+    typedef typename Op::value_type V;
+    size_t n = BufferBytes(from_buff)/sizeof(V);
+    int last = inclusive ? proc : proc-1;
+    Exchange(BufferAddr(from_buff), [&]() {
+      if (last < 0)
+        return;
+      V* to = static_cast<V*>(BufferAddr(to_buff));
+      for (size_t i=0; i<n; ++i) {
+        V val = static_cast<const V*>(world->ptrs[last])[i];
+        for (int p=last-1; p>=0; --p)
+          op(static_cast<const V*>(world->ptrs[p])[i], val);
+        to[i] = val;
+      }
+    });
+    return 0;
+  }
+
+  // Scan
+  template<class T, class Op>
+  inline int Scan(T &from_buff, T &to_buff, Op op) { return ScanBuffer(from_buff, to_buff, op, true); }
+
+  // ExScan (to_buff is left untouched on process 0)
+  template<class T, class Op>
+  inline int ExScan(T &from_buff, T &to_buff, Op op) { return ScanBuffer(from_buff, to_buff, op, false); }
+
+  template<class T>
+  inline int ScanSum(T &from_buff, T &to_buff) { return Scan(from_buff, to_buff, Plus<typename ElemType<T>::type>()); }
+  template<class T>
+  inline int ExScanSum(T &from_buff, T &to_buff) { return ExScan(from_buff, to_buff, Plus<typename ElemType<T>::type>()); }
+
+  // Offset of this process's share in a buffer concatenating every process's share, with the total
+  template<class T>
+  int GlobalOffset(T local, T &offset, T &total)
+  {
+    Exchange(&local, [&]() {
+      offset = T(0);
+      total = T(0);
+      for (int p=0; p<NumProcs(); ++p) {
+        T share = *static_cast<const T*>(world->ptrs[p]);
+        if (p < proc)
+          offset += share;
+        total += share;
+      }
+    });
+    return 0;
+  }
+
+  template<class T>
+  inline int Sum(int to_proc, T &from_buff, T &to_buff) { return Reduce(to_proc, from_buff, to_buff, Plus<typename ElemType<T>::type>()); }
+  template<class T>
+  inline int AllSum(T &from_buff, T &to_buff) { return AllReduce(from_buff, to_buff, Plus<typename ElemType<T>::type>()); }
+  template<class T>
+  inline int Product(int to_proc, T &from_buff, T &to_buff) { return Reduce(to_proc, from_buff, to_buff, Times<typename ElemType<T>::type>()); }
+  template<class T>
+  inline int AllProduct(T &from_buff, T &to_buff) { return AllReduce(from_buff, to_buff, Times<typename ElemType<T>::type>()); }
+
+  // Pipelined reductions: Reduce already splits the work among the threads
+  template<class T, class Op>
+  inline int PipelinedReduce(int to_proc, T &from_buff, T &to_buff, Op op) { return ReduceBuffer(to_proc, from_buff, to_buff, op); }
+  template<class T, class Op>
+  inline int PipelinedAllReduce(T &from_buff, T &to_buff, Op op) { return ReduceBuffer(-1, from_buff, to_buff, op); }
+  template<class T>
+  inline int PipelinedSum(int to_proc, T &from_buff, T &to_buff) { return Sum(to_proc, from_buff, to_buff); }
+  template<class T>
+  inline int PipelinedAllSum(T &from_buff, T &to_buff) { return AllSum(from_buff, to_buff); }
+
+  // Gather (to_buff holds NumProcs() blocks of from_buff's size, in process order)
+  template<class T>
+  int Gather(int to_proc, T &from_buff, T &to_buff)
+  {
+    size_t bytes = BufferBytes(from_buff);
+    Exchange(BufferAddr(from_buff), [&]() {
+      if ((to_proc < 0) || (proc == to_proc))
+        for (int p=0; p<NumProcs(); ++p)
+          if (bytes > 0)
+            memcpy(static_cast<char*>(BufferAddr(to_buff)) + p*bytes, world->ptrs[p], bytes);
+    });
+    return 0;
+  }
+
+  // AllGather
+  template<class T>
+  inline int AllGather(T &from_buff, T &to_buff) { return Gather(-1, from_buff, to_buff); }
+
+  // Gatherv (counts and displacements in elements, significant on to_proc)
+  template<class T>
+  int Gatherv(int to_proc, T &from_buff, T &to_buff, int* recvCounts, int* displacements)
+  {
+    typedef typename ElemType<T>::type V;
+    Exchange(BufferAddr(from_buff), [&]() {
+      if (proc == to_proc)
+        for (int p=0; p<NumProcs(); ++p)
+          if (recvCounts[p] > 0)
+            memcpy(static_cast<V*>(BufferAddr(to_buff)) + displacements[p], world->ptrs[p], recvCounts[p]*sizeof(V));
+    });
+    return 0;
+  }
+
+  /// Fills counts with every process's element count (on to_proc, or everywhere
+  /// if to_proc < 0), unless they are cached
+  void ExchangeCounts(int to_proc, size_t my_count, GathervCounts &counts)
+  {
+    if (counts.Cached(to_proc)) {
+      if (size_t(counts.my_count) != my_count) {
+        std::cerr << "ERROR: Count changed since GathervCounts was filled; Reset() it on every process!" << std::endl;
+        abort();
+      }
+      return;
+    }
+    if (my_count > INT_MAX) {
+      std::cerr << "ERROR: Variable-count gathers take at most INT_MAX elements per process!" << std::endl;
+      abort();
+    }
+    int n_procs = NumProcs();
+    counts.my_count = my_count;
+    counts.to_proc = to_proc;
+    counts.counts.assign(n_procs, 0);
+    counts.offsets.assign(n_procs+1, 0);
+    Exchange(0, [&]() {
+      if ((to_proc < 0) || (proc == to_proc))
+        for (int p=0; p<n_procs; ++p)
+          counts.counts[p] = world->sizes[p];
+    }, 0, my_count);
+    long total = 0;
+    for (int p=0; p<n_procs; ++p) {
+      total += counts.counts[p];
+      if (total > INT_MAX) {
+        std::cerr << "ERROR: Variable-count gathers take at most INT_MAX elements in all!" << std::endl;
+        abort();
+      }
+      counts.offsets[p+1] = total;
+    }
+  }
+
+  /// Gathers from_addr's counts.my_count elements of elem_bytes into to_addr at counts.offsets
+  int GathervBuffer(int to_proc, const void* from_addr, void* to_addr, size_t elem_bytes, GathervCounts &counts)
+  {
+    Exchange(from_addr, [&]() {
+      if ((to_proc < 0) || (proc == to_proc))
+        for (int p=0; p<NumProcs(); ++p)
+          if (counts.counts[p] > 0)
+            memcpy(static_cast<char*>(to_addr) + counts.offsets[p]*elem_bytes, world->ptrs[p], counts.counts[p]*elem_bytes);
+    });
+    return 0;
+  }
+
+  /** Gathers a different number of elements from every process, exchanging
+   * the counts first unless counts already holds them
+   * @param to_proc Process receiving the elements
+   * @param from_buff This process's elements
+   * @param to_buff All elements in process order, resized (on to_proc)
+   * @param counts Counts and offsets of every process's elements (on to_proc)
+   */
+  template<class T>
+  inline int Gatherv(int to_proc, matrix::vec<T> &from_buff, matrix::vec<T> &to_buff, GathervCounts &counts)
+  {
+    ExchangeCounts(to_proc, from_buff.size(), counts);
+    if (proc == to_proc)
+      to_buff.set_size(counts.Total());
+    return GathervBuffer(to_proc, BufferAddr(from_buff), BufferAddr(to_buff), sizeof(T), counts);
+  }
+
+  template<class T>
+  inline int Gatherv(int to_proc, std::vector<T> &from_buff, std::vector<T> &to_buff, GathervCounts &counts)
+  {
+    ExchangeCounts(to_proc, from_buff.size(), counts);
+    if (proc == to_proc)
+      to_buff.resize(counts.Total());
+    return GathervBuffer(to_proc, from_buff.data(), to_buff.data(), sizeof(T), counts);
+  }
+
+  // Gatherv, returning the offset of each process's elements (then the total) on to_proc
+  template<class V>
+  inline int Gatherv(int to_proc, V &from_buff, V &to_buff, std::vector<int> &offsets)
+  {
+    GathervCounts counts;
+    int status = Gatherv(to_proc, from_buff, to_buff, counts);
+    offsets.swap(counts.offsets);
+    return status;
+  }
+
+  // AllGatherv (as Gatherv, with the elements and counts on every process)
+  template<class T>
+  inline int AllGatherv(matrix::vec<T> &from_buff, matrix::vec<T> &to_buff, GathervCounts &counts)
+  {
+    ExchangeCounts(-1, from_buff.size(), counts);
+    to_buff.set_size(counts.Total());
+    return GathervBuffer(-1, BufferAddr(from_buff), BufferAddr(to_buff), sizeof(T), counts);
+  }
+
+  template<class T>
+  inline int AllGatherv(std::vector<T> &from_buff, std::vector<T> &to_buff, GathervCounts &counts)
+  {
+    ExchangeCounts(-1, from_buff.size(), counts);
+    to_buff.resize(counts.Total());
+    return GathervBuffer(-1, from_buff.data(), to_buff.data(), sizeof(T), counts);
+  }
+
+  // AllGatherv, returning the offset of each process's elements, then the total
+  template<class V>
+  inline int AllGatherv(V &from_buff, V &to_buff, std::vector<int> &offsets)
+  {
+    GathervCounts counts;
+    int status = AllGatherv(from_buff, to_buff, counts);
+    offsets.swap(counts.offsets);
+    return status;
+  }
+
+  // GatherCols (every process's columns side by side on to_proc, in process order)
+  template<class T>
+  int GatherCols(int to_proc, T &from_buff, T &to_buff)
+  {
+    typedef typename ElemType<T>::type V;
+#ifdef USE_ARMADILLO
+    int rows = from_buff.n_rows;
+    int cols = from_buff.n_cols;
+#elif defined USE_EIGEN
+    int rows = from_buff.rows();
+    int cols = from_buff.cols();
+#endif
+    Exchange(BufferAddr(from_buff), [&]() {
+      if (proc != to_proc)
+        return;
+      int total_cols = 0;
+      for (int p=0; p<NumProcs(); ++p)
+        total_cols += world->sizes[p];
+      to_buff.set_size(rows, total_cols);
+      V* to = static_cast<V*>(BufferAddr(to_buff));
+      for (int p=0; p<NumProcs(); ++p) {
+        if (world->sizes[p] > 0)
+          memcpy(to, world->ptrs[p], rows*world->sizes[p]*sizeof(V));
+        to += rows*world->sizes[p];
+      }
+    }, 0, cols);
+    return 0;
+  }
+
+  // AllGatherCols (each process fills in its ColBlock of buff's columns)
+  template <typename T>
+  int AllGatherCols(matrix::mat<T> &buff)
+  {
+#ifdef USE_ARMADILLO
+    int rows = buff.n_rows;
+    int cols = buff.n_cols;
+#endif
+#ifdef USE_EIGEN
+    int rows = buff.rows();
+    int cols = buff.cols();
+#endif
+    Exchange(BufferAddr(buff), [&]() {
+      for (int p=0; p<NumProcs(); ++p) {
+        int first_col, n_cols;
+        ColBlock(cols, p, NumProcs(), first_col, n_cols);
+        if ((p != proc) && (n_cols > 0))
+          memcpy(static_cast<T*>(BufferAddr(buff)) + size_t(rows)*first_col, static_cast<const T*>(world->ptrs[p]) + size_t(rows)*first_col, size_t(rows)*n_cols*sizeof(T));
+      }
+    });
+    return 0;
+  }
+
+  // Scatter (from_buff holds NumProcs() blocks of to_buff's size)
+  template<class T>
+  int Scatter(int from_proc, T &from_buff, T &to_buff)
+  {
+    size_t bytes = BufferBytes(to_buff);
+    Exchange(proc == from_proc ? BufferAddr(from_buff) : 0, [&]() {
+      if (bytes > 0)
+        memcpy(BufferAddr(to_buff), static_cast<const char*>(world->ptrs[from_proc]) + proc*bytes, bytes);
+    });
+    return 0;
+  }
+
+  // Scatterv (counts and displacements in elements, significant on from_proc; each process receives to_buff's size)
+  template<class T>
+  int Scatterv(int from_proc, T &from_buff, T &to_buff, int* send_counts, int* displacements)
+  {
+    typedef typename ElemType<T>::type V;
+    Exchange(proc == from_proc ? BufferAddr(from_buff) : 0, [&]() {
+      if (BufferBytes(to_buff) > 0)
+        memcpy(BufferAddr(to_buff), static_cast<const V*>(world->ptrs[from_proc]) + static_cast<const int*>(world->aux[from_proc])[proc], BufferBytes(to_buff));
+    }, displacements);
+    return 0;
+  }
+
+  /** Sends an equal block of from_buff to every process, in process order
+   * @param from_buff Reference to sending buffer, NumProcs() blocks
+   * @param to_buff Reference to receiving buffer, the same size
+   */
+  template<class T>
+  int Alltoall(T &from_buff, T &to_buff)
+  {
+    size_t block = BufferBytes(from_buff)/NumProcs();
+    Exchange(BufferAddr(from_buff), [&]() {
+      for (int p=0; p<NumProcs(); ++p)
+        if (block > 0)
+          memcpy(static_cast<char*>(BufferAddr(to_buff)) + p*block, static_cast<const char*>(world->ptrs[p]) + proc*block, block);
+    });
+    return 0;
+  }
+
+  /** Sends a block of from_buff of any size to every process
+   * @param from_buff Reference to sending buffer
+   * @param send_counts Elements sent to each process
+   * @param send_displacements Offset of each process's block in from_buff
+   * @param to_buff Reference to receiving buffer
+   * @param recv_counts Elements received from each process
+   * @param recv_displacements Offset of each process's block in to_buff
+   */
+  template<class T>
+  int Alltoallv(T &from_buff, int* send_counts, int* send_displacements, T &to_buff, int* recv_counts, int* recv_displacements)
+  {
+    typedef typename ElemType<T>::type V;
+    Exchange(BufferAddr(from_buff), [&]() {
+      for (int p=0; p<NumProcs(); ++p)
+        if (recv_counts[p] > 0)
+          memcpy(static_cast<V*>(BufferAddr(to_buff)) + recv_displacements[p], static_cast<const V*>(world->ptrs[p]) + static_cast<const int*>(world->aux[p])[proc], recv_counts[p]*sizeof(V));
+    }, send_displacements);
+    return 0;
+  }
+
+  // ScatterCols (each process gets its ColBlock of from_proc's columns)
+  template<class T>
+  int ScatterCols(int from_proc, T &from_buff, T &to_buff)
+  {
+    typedef typename ElemType<T>::type V;
+#ifdef USE_ARMADILLO
+    int rows = from_buff.n_rows;
+    int cols = from_buff.n_cols;
+#elif defined USE_EIGEN
+    int rows = from_buff.rows();
+    int cols = from_buff.cols();
+#endif
+    int first_col, n_cols;
+    ColBlock(cols, proc, NumProcs(), first_col, n_cols);
+    to_buff.set_size(rows, n_cols);
+    Exchange(proc == from_proc ? BufferAddr(from_buff) : 0, [&]() {
+      if (n_cols > 0)
+        memcpy(BufferAddr(to_buff), static_cast<const V*>(world->ptrs[from_proc]) + size_t(rows)*first_col, size_t(rows)*n_cols*sizeof(V));
+    });
+    return 0;
+  }
+
+#else   // Serial version
+  inline void SetWorld(){}
+  inline int MyProc() {return 0;}
+  inline int NumProcs() {return 1;}
+  inline std::string MyHost() {return "0";}
+  inline void BarrierSync() {}
+  inline void Split(int color, Communicator &new_comm) {}
+  inline void SplitShared(Communicator &node_comm) {}
+  inline long NextEpoch() { static long epoch = 0; return epoch++; }
+  inline void CartCreate(std::vector<int> &dims, const std::vector<int> &periods, Communicator &cart_comm, bool reorder=false)
+  {
+    for (auto &dim: dims)
+      dim = 1;
+  }
+  inline int CartDims() {return 0;}
+  inline void CartShift(int dim, int disp, int &source, int &dest) {source = 0; dest = 0;}
+  inline void CartCoords(int proc, std::vector<int> &coords) {coords.assign(coords.size(), 0);}
+  inline int CartRank(const std::vector<int> &coords) {return 0;}
+  inline void Subset(matrix::vec<int> &ranks, Communicator &new_comm)
+  {
+    if (ranks.size() != 1) {
+      std::cerr << "Serial verion of code does not support nontrivial subsets. Exiting.\n";
+      abort();
+    }
+  }
+
+  inline void Dup(Communicator &new_comm) {}
+  inline void Free() {}
+
+  enum { ANY_SOURCE = -1, ANY_TAG = -1, PROC_NULL = -2 };
+  inline int Probe(int from_proc, int tag, int &source) {source = 0; return 0;}
+  inline bool IProbe(int from_proc, int tag, int &source) {return false;}
+  template<class T>
+  inline int Send(int to_proc, T &val, int tag=0) {}
+  template<class T>
+  inline int Receive(int from_proc, T &val, int tag=0) {}
+  template<class T>
+  inline int ReceiveResize(int from_proc, T &val, int tag=0) {return 0;}
   template<class T>
   inline int SendReceive (int from_proc, T &from_buff, int to_proc, T &to_buff) {to_buff = from_buff;}
+  static BroadcastAlgorithm& BroadcastAlgo() { static BroadcastAlgorithm algo = BCAST_AUTO; return algo; }
+  static size_t& LargeBroadcastBytes() { static size_t large_bytes = 1<<19; return large_bytes; }
+  static std::vector< std::pair<size_t, BroadcastAlgorithm> >& BroadcastTable() { static std::vector< std::pair<size_t, BroadcastAlgorithm> > table; return table; }
+  template<class T>
+  inline int Broadcast(int from_proc, T &val, BroadcastAlgorithm algo=BroadcastAlgo()) {return 0;}
+  template<class T, class Op>
+  inline int Reduce(int to_proc, T &from_buff, T &to_buff, Op op) {to_buff = from_buff; return 0;}
+  template<class T, class Op>
+  inline int AllReduce(T &from_buff, T &to_buff, Op op) {to_buff = from_buff; return 0;}
+  template<class T, class Op>
+  inline int Scan(T &from_buff, T &to_buff, Op op) {to_buff = from_buff; return 0;}
+  template<class T, class Op>
+  inline int ExScan(T &from_buff, T &to_buff, Op op) {return 0;}
+  template<class T>
+  inline int ScanSum(T &from_buff, T &to_buff) {to_buff = from_buff; return 0;}
   template<class T>
-  inline int Broadcast(int from_proc, T &val) {}
+  inline int ExScanSum(T &from_buff, T &to_buff) {return 0;}
+  template<class T>
+  inline int GlobalOffset(T local, T &offset, T &total) {offset = T(0); total = local; return 0;}
   template<class T>
   inline int Sum(int to_proc, T &from_buff, T &to_buff) {to_buff = from_buff;}
   template<class T>
@@ -325,12 +2039,43 @@ public:
   inline int Product(int to_proc, T &from_buff, T &to_buff) {to_buff = from_buff;}
   template<class T>
   inline int AllProduct(T &from_buff, T &to_buff) {to_buff = from_buff;}
+  static size_t& SegmentSize() { static size_t segment_size = 1<<16; return segment_size; }
+  static int& PipelineDepth() { static int pipeline_depth = 4; return pipeline_depth; }
+  template<class T, class Op>
+  inline int PipelinedReduce(int to_proc, T &from_buff, T &to_buff, Op op) {to_buff = from_buff; return 0;}
+  template<class T, class Op>
+  inline int PipelinedAllReduce(T &from_buff, T &to_buff, Op op) {to_buff = from_buff; return 0;}
+  template<class T>
+  inline int PipelinedSum(int to_proc, T &from_buff, T &to_buff) {to_buff = from_buff; return 0;}
+  template<class T>
+  inline int PipelinedAllSum(T &from_buff, T &to_buff) {to_buff = from_buff; return 0;}
   template<class T>
   inline int Gather(int to_proc, T &from_buff, T &to_buff) {to_buff = from_buff;}
   template<class T>
   inline int Gatherv(int to_proc, T &from_buff, T &to_buff, int* recvCounts, int* displacements) {to_buff = from_buff;}
+  template<class V>
+  inline int Gatherv(int to_proc, V &from_buff, V &to_buff, GathervCounts &counts) {return AllGatherv(from_buff, to_buff, counts);}
+  template<class V>
+  inline int Gatherv(int to_proc, V &from_buff, V &to_buff, std::vector<int> &offsets) {return AllGatherv(from_buff, to_buff, offsets);}
   template<class T>
   inline int GatherCols(int to_proc, T &from_buff, T &to_buff) {to_buff = from_buff;}
+  template<class V>
+  inline int AllGatherv(V &from_buff, V &to_buff, GathervCounts &counts)
+  {
+    counts.my_count = from_buff.size();
+    counts.to_proc = -1;
+    counts.counts.assign(1, counts.my_count);
+    counts.offsets = {0, counts.my_count};
+    to_buff = from_buff;
+    return 0;
+  }
+  template<class V>
+  inline int AllGatherv(V &from_buff, V &to_buff, std::vector<int> &offsets)
+  {
+    offsets = {0, int(from_buff.size())};
+    to_buff = from_buff;
+    return 0;
+  }
   template<class T>
   inline int AllGather(T &from_buff, T &to_buff) {to_buff = from_buff;}
   template<class T>
@@ -338,6 +2083,10 @@ public:
   template<class T>
   inline int Scatterv(int from_proc, T &from_buff, T &to_buff, int* send_counts, int* displacements) {to_buff = from_buff;}
   template<class T>
+  inline int Alltoall(T &from_buff, T &to_buff) {to_buff = from_buff; return 0;}
+  template<class T>
+  inline int Alltoallv(T &from_buff, int* send_counts, int* send_displacements, T &to_buff, int* recv_counts, int* recv_displacements) {to_buff = from_buff; return 0;}
+  template<class T>
   inline int ScatterCols(int from_proc, T &from_buff, T &to_buff) {to_buff = from_buff;}
   template<class T>
   inline int AllGatherCols (matrix::mat<T> &buff) {}
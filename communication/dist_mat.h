@@ -0,0 +1,280 @@
+#ifndef SCAFFOLD_COMMUNICATION_DIST_MAT_H_
+#define SCAFFOLD_COMMUNICATION_DIST_MAT_H_
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Rectangular grid of processes laid out row-major over a communicator.
+/// A grid with one row gives the 1D column block-cyclic layout.
+class ProcessGrid
+{
+public:
+  ProcessGrid(Communicator &t_comm, int t_p_rows=1)
+    : comm(t_comm), p_rows(t_p_rows)
+  {
+    int n_procs = comm.NumProcs();
+    if ((p_rows < 1) || (n_procs % p_rows) != 0) {
+      std::cerr << "ERROR: ProcessGrid: " << p_rows << " rows do not divide " << n_procs << " processes!" << std::endl;
+      abort();
+    }
+    p_cols = n_procs/p_rows;
+    my_p_row = comm.MyProc()/p_cols;
+    my_p_col = comm.MyProc()%p_cols;
+    comm.Split(my_p_row, row_comm); // Ranks ordered by process column
+    comm.Split(my_p_col, col_comm); // Ranks ordered by process row
+  }
+
+  ~ProcessGrid()
+  {
+    row_comm.Free();
+    col_comm.Free();
+  }
+
+  ProcessGrid(const ProcessGrid&) = delete;
+  ProcessGrid& operator=(const ProcessGrid&) = delete;
+
+  /// Rank in comm of the process at (p_row, p_col)
+  inline int Proc(int p_row, int p_col) { return p_row*p_cols + p_col; }
+
+  Communicator comm; // All processes of the grid
+  Communicator row_comm; // Processes sharing my process row
+  Communicator col_comm; // Processes sharing my process column
+  int p_rows, p_cols, my_p_row, my_p_col;
+};
+
+/// Number of indices of a length n dimension, cut in blocks of nb, held by process i_proc of n_procs
+inline int BlockCyclicNumLocal(int n, int nb, int i_proc, int n_procs)
+{
+  int n_blocks = n/nb;
+  int n_local = (n_blocks/n_procs)*nb;
+  int extra = n_blocks%n_procs;
+  if (i_proc < extra)
+    n_local += nb;
+  else if (i_proc == extra)
+    n_local += n%nb;
+  return n_local;
+}
+
+/// Process holding global index g
+inline int BlockCyclicOwner(int g, int nb, int n_procs) { return (g/nb)%n_procs; }
+
+/// Local index of global index g on its owner
+inline int BlockCyclicGlobalToLocal(int g, int nb, int n_procs) { return (g/(nb*n_procs))*nb + g%nb; }
+
+/// Global index of local index l on process i_proc
+inline int BlockCyclicLocalToGlobal(int l, int nb, int i_proc, int n_procs) { return ((l/nb)*n_procs + i_proc)*nb + l%nb; }
+
+/// Matrix distributed 2D block-cyclically over a ProcessGrid, with each
+/// process storing its blocks contiguously in a local matrix::mat
+template<class T>
+class DistMat
+{
+public:
+  DistMat(ProcessGrid &t_grid, int t_n_rows, int t_n_cols, int t_mb, int t_nb)
+    : grid(t_grid), n_rows(t_n_rows), n_cols(t_n_cols), mb(t_mb), nb(t_nb)
+  {
+    local = matrix::zeros<matrix::mat<T>>(LocalRows(), LocalCols());
+  }
+
+  ProcessGrid &grid;
+  int n_rows, n_cols; // Global shape
+  int mb, nb; // Block shape
+  matrix::mat<T> local; // My blocks
+
+  inline int LocalRows(int p_row) { return BlockCyclicNumLocal(n_rows, mb, p_row, grid.p_rows); }
+  inline int LocalCols(int p_col) { return BlockCyclicNumLocal(n_cols, nb, p_col, grid.p_cols); }
+  inline int LocalRows() { return LocalRows(grid.my_p_row); }
+  inline int LocalCols() { return LocalCols(grid.my_p_col); }
+  inline int GlobalRow(int i, int p_row) { return BlockCyclicLocalToGlobal(i, mb, p_row, grid.p_rows); }
+  inline int GlobalCol(int j, int p_col) { return BlockCyclicLocalToGlobal(j, nb, p_col, grid.p_cols); }
+  inline int GlobalRow(int i) { return GlobalRow(i, grid.my_p_row); }
+  inline int GlobalCol(int j) { return GlobalCol(j, grid.my_p_col); }
+
+  /// Rank in grid.comm owning global element (i,j)
+  inline int Owner(int i, int j)
+  {
+    return grid.Proc(BlockCyclicOwner(i, mb, grid.p_rows), BlockCyclicOwner(j, nb, grid.p_cols));
+  }
+
+  /** Distributes a full matrix held by one process
+   * @param from_proc ID of the process holding the full matrix
+   * @param global Full matrix (only read on from_proc)
+   * return the MPI status
+   */
+  int Scatter(int from_proc, matrix::mat<T> &global)
+  {
+    int n_procs = grid.comm.NumProcs();
+    std::vector<int> send_counts(n_procs), displacements(n_procs);
+    int total = Layout(send_counts, displacements);
+    matrix::mat<T> packed;
+    if (grid.comm.MyProc() == from_proc) {
+      packed.set_size(total, 1);
+      for (int p_row=0; p_row<grid.p_rows; ++p_row)
+        for (int p_col=0; p_col<grid.p_cols; ++p_col) {
+          int proc_rows = LocalRows(p_row), proc_cols = LocalCols(p_col);
+          int k = displacements[grid.Proc(p_row,p_col)];
+          for (int j=0; j<proc_cols; ++j)
+            for (int i=0; i<proc_rows; ++i)
+              packed(k++) = global(GlobalRow(i,p_row), GlobalCol(j,p_col));
+        }
+    }
+    int my_rows = LocalRows(), my_cols = LocalCols();
+    matrix::mat<T> mine(my_rows*my_cols, 1);
+    int status = grid.comm.Scatterv(from_proc, packed, mine, send_counts.data(), displacements.data());
+    local.set_size(my_rows, my_cols);
+    for (int k=0; k<my_rows*my_cols; ++k)
+      local(k) = mine(k);
+    return status;
+  }
+
+  /** Collects the full matrix onto one process
+   * @param to_proc ID of the receiving process
+   * @param global Full matrix (resized and written on to_proc)
+   * return the MPI status
+   */
+  int Gather(int to_proc, matrix::mat<T> &global)
+  {
+    int n_procs = grid.comm.NumProcs();
+    std::vector<int> recv_counts(n_procs), displacements(n_procs);
+    int total = Layout(recv_counts, displacements);
+    matrix::mat<T> packed;
+    if (grid.comm.MyProc() == to_proc)
+      packed.set_size(total, 1);
+    int status = grid.comm.Gatherv(to_proc, local, packed, recv_counts.data(), displacements.data());
+    if (grid.comm.MyProc() == to_proc) {
+      global.set_size(n_rows, n_cols);
+      for (int p_row=0; p_row<grid.p_rows; ++p_row)
+        for (int p_col=0; p_col<grid.p_cols; ++p_col) {
+          int proc_rows = LocalRows(p_row), proc_cols = LocalCols(p_col);
+          int k = displacements[grid.Proc(p_row,p_col)];
+          for (int j=0; j<proc_cols; ++j)
+            for (int i=0; i<proc_rows; ++i)
+              global(GlobalRow(i,p_row), GlobalCol(j,p_col)) = packed(k++);
+        }
+    }
+    return status;
+  }
+
+  /** Copies this matrix into another layout over the same processes
+   * @param dest Destination matrix with the same global shape, any grid shape and blocking,
+   *        whose grid is built on the same communicator
+   */
+  void Redistribute(DistMat<T> &dest)
+  {
+    if ((dest.n_rows != n_rows) || (dest.n_cols != n_cols)) {
+      std::cerr << "ERROR: DistMat::Redistribute: global shapes differ!" << std::endl;
+      abort();
+    }
+    int n_procs = grid.comm.NumProcs();
+
+    // Elements are packed in global column-major order, which both sides can reproduce
+    std::vector<int> send_counts(n_procs,0), recv_counts(n_procs,0);
+    int my_rows = LocalRows(), my_cols = LocalCols();
+    for (int j=0; j<my_cols; ++j)
+      for (int i=0; i<my_rows; ++i)
+        send_counts[dest.Owner(GlobalRow(i),GlobalCol(j))]++;
+    int dest_rows = dest.LocalRows(), dest_cols = dest.LocalCols();
+    for (int j=0; j<dest_cols; ++j)
+      for (int i=0; i<dest_rows; ++i)
+        recv_counts[Owner(dest.GlobalRow(i),dest.GlobalCol(j))]++;
+    std::vector<int> send_displacements(n_procs,0), recv_displacements(n_procs,0);
+    for (int proc=1; proc<n_procs; ++proc) {
+      send_displacements[proc] = send_displacements[proc-1] + send_counts[proc-1];
+      recv_displacements[proc] = recv_displacements[proc-1] + recv_counts[proc-1];
+    }
+
+    // Pack
+    matrix::vec<T> send_buff(my_rows*my_cols), recv_buff(dest_rows*dest_cols);
+    std::vector<int> pos(send_displacements);
+    for (int j=0; j<my_cols; ++j)
+      for (int i=0; i<my_rows; ++i)
+        send_buff(pos[dest.Owner(GlobalRow(i),GlobalCol(j))]++) = local(i,j);
+
+    // Exchange
+    grid.comm.Alltoallv(send_buff, send_counts.data(), send_displacements.data(),
+                        recv_buff, recv_counts.data(), recv_displacements.data());
+
+    // Unpack
+    pos = recv_displacements;
+    dest.local.set_size(dest_rows, dest_cols);
+    for (int j=0; j<dest_cols; ++j)
+      for (int i=0; i<dest_rows; ++i)
+        dest.local(i,j) = recv_buff(pos[Owner(dest.GlobalRow(i),dest.GlobalCol(j))]++);
+  }
+
+private:
+  // Fill per-process element counts and offsets, returning the total
+  int Layout(std::vector<int> &counts, std::vector<int> &displacements)
+  {
+    int total = 0;
+    for (int p_row=0; p_row<grid.p_rows; ++p_row)
+      for (int p_col=0; p_col<grid.p_cols; ++p_col) {
+        int proc = grid.Proc(p_row,p_col);
+        counts[proc] = LocalRows(p_row)*LocalCols(p_col);
+        displacements[proc] = total;
+        total += counts[proc];
+      }
+    return total;
+  }
+
+};
+
+/** Distributed matrix multiply C = A*B by SUMMA. Panels of A are broadcast
+ * along process rows and panels of B along process columns, and each process
+ * accumulates its blocks of C with a local (BLAS) matrix product.
+ * @param A Left matrix (m x k)
+ * @param B Right matrix (k x n), with B.mb == A.nb
+ * @param C Result (m x n), with C.mb == A.mb and C.nb == B.nb
+ */
+template<class T>
+void Multiply(DistMat<T> &A, DistMat<T> &B, DistMat<T> &C)
+{
+  if ((A.n_cols != B.n_rows) || (C.n_rows != A.n_rows) || (C.n_cols != B.n_cols)
+      || (A.nb != B.mb) || (C.mb != A.mb) || (C.nb != B.nb)
+      || (&A.grid != &B.grid) || (&A.grid != &C.grid)) {
+    std::cerr << "ERROR: Multiply: nonconforming distributed matrices!" << std::endl;
+    abort();
+  }
+  ProcessGrid &grid = C.grid;
+  int kb = A.nb;
+  int n_k = A.n_cols;
+  int my_rows = A.LocalRows(), my_cols = B.LocalCols();
+  C.local = matrix::zeros<matrix::mat<T>>(C.LocalRows(), C.LocalCols());
+  matrix::mat<T> A_panel, B_panel;
+  for (int k_block=0; k_block*kb<n_k; ++k_block) {
+    int width = std::min(kb, n_k - k_block*kb);
+    int owner_col = k_block%grid.p_cols;
+    int owner_row = k_block%grid.p_rows;
+
+    // Panel of A along my process row
+    A_panel.set_size(my_rows, width);
+    if (grid.my_p_col == owner_col) {
+      int offset = (k_block/grid.p_cols)*kb;
+      for (int j=0; j<width; ++j)
+        for (int i=0; i<my_rows; ++i)
+          A_panel(i,j) = A.local(i,offset+j);
+    }
+    grid.row_comm.Broadcast(owner_col, A_panel);
+
+    // Panel of B along my process column
+    B_panel.set_size(width, my_cols);
+    if (grid.my_p_row == owner_row) {
+      int offset = (k_block/grid.p_rows)*kb;
+      for (int j=0; j<my_cols; ++j)
+        for (int i=0; i<width; ++i)
+          B_panel(i,j) = B.local(offset+i,j);
+    }
+    grid.col_comm.Broadcast(owner_row, B_panel);
+
+    // Local update
+    C.local += A_panel*B_panel;
+  }
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_DIST_MAT_H_
@@ -0,0 +1,231 @@
+#ifndef SCAFFOLD_COMMUNICATION_DISTRIBUTED_MAP_H_
+#define SCAFFOLD_COMMUNICATION_DISTRIBUTED_MAP_H_
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <functional>
+#include <unordered_map>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Key-value store partitioned over the processes of a communicator, each
+/// key living on the process its hash picks. Inserts and lookups are
+/// batched and collective: each process packs its keys (and values) per
+/// owner, one Alltoallv carries the requests and, for lookups, a second
+/// carries the answers back. Keys and values go through the serialization
+/// layer (serialize.h), so they may be primitives, matrices, strings or
+/// containers of these. With caching on, values looked up from other
+/// processes are kept locally and later lookups of them skip the exchange.
+/// Insert drops cached copies of the keys this process inserts, but not of
+/// keys inserted elsewhere, so caching suits write-once data such as cached
+/// results; otherwise call ClearCache() after inserts. The hash must agree
+/// on every process.
+template<class K, class V, class Hash=std::hash<K> >
+class DistributedMap
+{
+public:
+  /** Creates an empty map
+   * @param t_comm Processes sharing the map
+   * @param t_caching Whether to keep values looked up from other processes
+   */
+  DistributedMap(Communicator &t_comm, bool t_caching=false)
+    : comm(t_comm), caching(t_caching)
+  {
+    n_procs = comm.NumProcs();
+    my_proc = comm.MyProc();
+  }
+
+  /// Process holding key
+  inline int Owner(const K &key) { return hash(key) % n_procs; }
+
+  /// Entries held by this process
+  inline std::unordered_map<K,V,Hash>& Local() { return local; }
+
+  /// Entries over all processes (collective)
+  long Size()
+  {
+    long my_size = local.size(), size = 0;
+    comm.AllSum(my_size, size);
+    return size;
+  }
+
+  inline void ClearCache() { cache.clear(); }
+
+  /** Stores every entry with its owner (collective). Entries for the same
+   * key are applied in process order, so the highest process's stays.
+   * @param entries This process's keys and values, in any order
+   */
+  void Insert(std::vector< std::pair<K,V> > &entries)
+  {
+    std::vector< std::vector<char> > send(n_procs);
+    std::vector<SizeArchive> sizes(n_procs);
+    for (auto &entry: entries)
+      SerializeEntry(sizes[Owner(entry.first)], entry.first, entry.second);
+    std::vector<PackArchive> packs = Packs(send, sizes);
+    for (auto &entry: entries)
+      SerializeEntry(packs[Owner(entry.first)], entry.first, entry.second);
+
+    std::vector<char> recv;
+    std::vector<int> recv_offsets;
+    Exchange(send, recv, recv_offsets);
+    UnpackArchive ar(recv.data());
+    while (ar.pos < recv.data() + recv.size()) {
+      K key;
+      Serialize(ar, key);
+      Serialize(ar, local[key]);
+    }
+
+    // Another process may have inserted the same key later in process order,
+    // so only the owner knows what stayed
+    if (caching)
+      for (auto &entry: entries)
+        cache.erase(entry.first);
+  }
+
+  /** Looks up keys wherever they live (collective)
+   * @param keys Keys wanted by this process
+   * @param vals Their values, resized to match keys (left default where missing)
+   * @param found Whether each key was present
+   */
+  void Lookup(std::vector<K> &keys, std::vector<V> &vals, std::vector<int> &found)
+  {
+    vals.assign(keys.size(), V());
+    found.assign(keys.size(), 0);
+
+    // Answer what we can here; ask owners for the rest, in key order per owner
+    std::vector< std::vector<size_t> > asked(n_procs);
+    for (size_t i=0; i<keys.size(); ++i) {
+      int owner = Owner(keys[i]);
+      std::unordered_map<K,V,Hash> &known = (owner == my_proc) ? local : cache;
+      auto it = known.find(keys[i]);
+      if (it != known.end()) {
+        vals[i] = it->second;
+        found[i] = 1;
+      } else if (owner != my_proc)
+        asked[owner].push_back(i);
+    }
+    std::vector< std::vector<char> > send(n_procs);
+    std::vector<SizeArchive> sizes(n_procs);
+    for (int proc=0; proc<n_procs; ++proc)
+      for (size_t i: asked[proc])
+        Serialize(sizes[proc], keys[i]);
+    std::vector<PackArchive> packs = Packs(send, sizes);
+    for (int proc=0; proc<n_procs; ++proc)
+      for (size_t i: asked[proc])
+        Serialize(packs[proc], keys[i]);
+    std::vector<char> recv;
+    std::vector<int> recv_offsets;
+    Exchange(send, recv, recv_offsets);
+
+    // Answer each request with a found flag and the value
+    std::vector< std::vector<K> > requests(n_procs);
+    for (int proc=0; proc<n_procs; ++proc) {
+      UnpackArchive ar(recv.data() + recv_offsets[proc]);
+      while (ar.pos < recv.data() + recv_offsets[proc+1]) {
+        requests[proc].push_back(K());
+        Serialize(ar, requests[proc].back());
+      }
+    }
+    V missing = V();
+    std::vector<SizeArchive> answer_sizes(n_procs);
+    for (int proc=0; proc<n_procs; ++proc)
+      for (auto &key: requests[proc])
+        SerializeAnswer(answer_sizes[proc], key, missing);
+    std::vector< std::vector<char> > answers(n_procs);
+    packs = Packs(answers, answer_sizes);
+    for (int proc=0; proc<n_procs; ++proc)
+      for (auto &key: requests[proc])
+        SerializeAnswer(packs[proc], key, missing);
+    Exchange(answers, recv, recv_offsets);
+
+    for (int proc=0; proc<n_procs; ++proc) {
+      UnpackArchive ar(recv.data() + recv_offsets[proc]);
+      for (size_t i: asked[proc]) {
+        Serialize(ar, found[i]);
+        Serialize(ar, vals[i]);
+        if (caching && found[i])
+          cache[keys[i]] = vals[i];
+      }
+    }
+  }
+
+private:
+  Communicator comm;
+  int n_procs, my_proc;
+  bool caching;
+  Hash hash;
+  std::unordered_map<K,V,Hash> local; // Entries owned here
+  std::unordered_map<K,V,Hash> cache; // Entries owned elsewhere, as last seen
+
+  template<class Ar>
+  static inline void SerializeEntry(Ar &ar, const K &key, const V &val)
+  {
+    Serialize(ar, const_cast<K&>(key)); // Only read when saving
+    Serialize(ar, const_cast<V&>(val));
+  }
+
+  template<class Ar>
+  inline void SerializeAnswer(Ar &ar, K &key, V &missing)
+  {
+    auto it = local.find(key);
+    int found = (it != local.end());
+    Serialize(ar, found);
+    Serialize(ar, found ? it->second : missing);
+  }
+
+  // Sizes each buffer and returns archives packing into them
+  static std::vector<PackArchive> Packs(std::vector< std::vector<char> > &buffs, std::vector<SizeArchive> &sizes)
+  {
+    std::vector<PackArchive> packs;
+    for (size_t proc=0; proc<buffs.size(); ++proc) {
+      buffs[proc].resize(sizes[proc].size);
+      packs.push_back(PackArchive(buffs[proc].data()));
+    }
+    return packs;
+  }
+
+  /// Sends send[proc] to each proc, receiving every process's bytes for this
+  /// one into recv, the ones from proc starting at recv_offsets[proc]
+  void Exchange(std::vector< std::vector<char> > &send, std::vector<char> &recv, std::vector<int> &recv_offsets)
+  {
+    std::vector<int> send_counts(n_procs), send_offsets(n_procs+1, 0), recv_counts(n_procs);
+    for (int proc=0; proc<n_procs; ++proc) {
+      if (send[proc].size() > INT_MAX - size_t(send_offsets[proc])) {
+        std::cerr << "ERROR: DistributedMap batch exceeds INT_MAX bytes!" << std::endl;
+        abort();
+      }
+      send_counts[proc] = send[proc].size();
+      send_offsets[proc+1] = send_offsets[proc] + send_counts[proc];
+    }
+    std::vector<char> send_buff;
+    send_buff.reserve(send_offsets[n_procs]);
+    for (auto &buff: send)
+      send_buff.insert(send_buff.end(), buff.begin(), buff.end());
+  #if USE_MPI
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm.MPIComm);
+  #else
+    comm.Alltoall(send_counts, recv_counts);
+  #endif
+    recv_offsets.assign(n_procs+1, 0);
+    for (int proc=0; proc<n_procs; ++proc) {
+      if (recv_counts[proc] > INT_MAX - recv_offsets[proc]) {
+        std::cerr << "ERROR: DistributedMap batch exceeds INT_MAX bytes!" << std::endl;
+        abort();
+      }
+      recv_offsets[proc+1] = recv_offsets[proc] + recv_counts[proc];
+    }
+    recv.resize(recv_offsets[n_procs]);
+  #if USE_MPI
+    MPI_Alltoallv(send_buff.data(), send_counts.data(), send_offsets.data(), MPI_BYTE,
+                  recv.data(), recv_counts.data(), recv_offsets.data(), MPI_BYTE, comm.MPIComm);
+  #else
+    comm.Alltoallv(send_buff, send_counts.data(), send_offsets.data(), recv, recv_counts.data(), recv_offsets.data());
+  #endif
+  }
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_DISTRIBUTED_MAP_H_
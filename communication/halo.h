@@ -0,0 +1,255 @@
+#ifndef SCAFFOLD_COMMUNICATION_HALO_H_
+#define SCAFFOLD_COMMUNICATION_HALO_H_
+
+#include <vector>
+#include <utility>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Halo (ghost cell) exchange for a column-major array decomposed over a
+/// Cartesian communicator (see Communicator::CartCreate), whose dimension d
+/// splits array dimension d. Every local array carries width layers of halo
+/// on both sides of each split dimension; Exchange() fills them with the
+/// neighbors' boundary layers, sending to all neighbors at once with
+/// non-blocking messages. Only faces are exchanged unless corners is set, in
+/// which case dimensions go one after another so edges and corners fill too.
+/// Without MPI the layers are copied out and in by hand and go as ordinary
+/// messages; serial builds have no neighbors and leave halos untouched.
+template<class T>
+class HaloExchange
+{
+public:
+  /** Builds the boundary and halo datatypes
+   * @param t_comm Cartesian communicator
+   * @param t_dims Local array extents, halos included (e.g. rows, cols, slices)
+   * @param t_width Halo width
+   * @param t_corners Whether to fill edge and corner halos as well as faces
+   */
+  HaloExchange(Communicator &t_comm, const std::vector<int> &t_dims, int t_width, bool t_corners=false)
+    : comm(t_comm), dims(t_dims), width(t_width), corners(t_corners)
+  {
+    n_split = comm.CartDims();
+  #if USE_MPI
+    T elem = T();
+    MPI_Datatype type = MPITypeTraits<T>::GetType(elem);
+  #endif
+    for (int d=0; d<n_split; ++d) {
+      int lo, hi;
+      comm.CartShift(d, 1, lo, hi);
+      neighbors.push_back(lo);
+      neighbors.push_back(hi);
+    #if USE_MPI
+      send_types.push_back(Slab(d, width, type));
+      send_types.push_back(Slab(d, dims[d]-2*width, type));
+      recv_types.push_back(Slab(d, 0, type));
+      recv_types.push_back(Slab(d, dims[d]-width, type));
+    #else
+      send_boxes.push_back(Slab(d, width));
+      send_boxes.push_back(Slab(d, dims[d]-2*width));
+      recv_boxes.push_back(Slab(d, 0));
+      recv_boxes.push_back(Slab(d, dims[d]-width));
+    #endif
+    }
+  }
+
+  ~HaloExchange()
+  {
+  #if USE_MPI
+    for (int i=0; i<send_types.size(); ++i) {
+      MPI_Type_free(&send_types[i]);
+      MPI_Type_free(&recv_types[i]);
+    }
+  #endif
+  }
+
+  HaloExchange(const HaloExchange&) = delete;
+  HaloExchange& operator=(const HaloExchange&) = delete;
+
+  /// Starts filling the halos of data, so interior work can overlap (faces only)
+  void Start(T* data)
+  {
+    if (corners)
+      Exchange(data);
+    else
+      for (int d=0; d<n_split; ++d)
+        Post(d, data);
+  }
+
+  /// Waits for the halos started by Start
+  void Wait()
+  {
+  #if USE_MPI
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+    requests.clear();
+  #else
+    // The down halo gets what travels up from below (tag 2d+1), the up halo what travels down (tag 2d)
+    for (auto &post: posted) {
+      int d = post.first;
+      for (int side=0; side<2; ++side) {
+        std::vector<T> layer;
+        comm.Receive(neighbors[2*d+side], layer, 2*d+1-side);
+        if (layer.empty())
+          continue;
+        size_t i = 0;
+        ForBox(post.second, recv_boxes[2*d+side], [&](T &elem) { elem = layer[i++]; });
+      }
+    }
+    posted.clear();
+  #endif
+  }
+
+  /// Fills the halos of data
+  void Exchange(T* data)
+  {
+    for (int d=0; d<n_split; ++d) {
+      Post(d, data);
+      if (corners)
+        Wait();
+    }
+    Wait();
+  }
+
+private:
+  Communicator comm;
+  std::vector<int> dims;
+  int width;
+  bool corners;
+  int n_split;
+  std::vector<int> neighbors; // Down and up neighbor along each split dimension
+
+  // Layers [start, start+width) of dimension d, over the interior of the other
+  // split dimensions (all of those already exchanged when filling corners),
+  // as the first index and extent along every dimension
+  void SlabBox(int d, int start, std::vector<int> &starts, std::vector<int> &sub_dims)
+  {
+    int n_dims = dims.size();
+    sub_dims.resize(n_dims);
+    starts.resize(n_dims);
+    for (int e=0; e<n_dims; ++e) {
+      bool full = (e >= n_split) || (corners && (e < d));
+      sub_dims[e] = full ? dims[e] : dims[e]-2*width;
+      starts[e] = full ? 0 : width;
+    }
+    sub_dims[d] = width;
+    starts[d] = start;
+  }
+
+#if USE_MPI
+  std::vector<MPI_Datatype> send_types, recv_types; // Down and up boundary/halo layers
+  std::vector<MPI_Request> requests;
+
+  MPI_Datatype Slab(int d, int start, MPI_Datatype type)
+  {
+    int n_dims = dims.size();
+    std::vector<int> sub_dims, starts;
+    SlabBox(d, start, starts, sub_dims);
+    MPI_Datatype slab;
+    MPI_Type_create_subarray(n_dims, dims.data(), sub_dims.data(), starts.data(), MPI_ORDER_FORTRAN, type, &slab);
+    MPI_Type_commit(&slab);
+    return slab;
+  }
+
+  // Tag 2d travels down dimension d, tag 2d+1 up
+  void Post(int d, T* data)
+  {
+    int lo = neighbors[2*d], hi = neighbors[2*d+1];
+    for (int i=0; i<4; ++i)
+      requests.push_back(MPI_REQUEST_NULL);
+    MPI_Request *r = &requests[requests.size()-4];
+    MPI_Irecv(data, 1, recv_types[2*d+1], hi, 2*d, comm.MPIComm, &r[0]);
+    MPI_Irecv(data, 1, recv_types[2*d], lo, 2*d+1, comm.MPIComm, &r[1]);
+    MPI_Isend(data, 1, send_types[2*d], lo, 2*d, comm.MPIComm, &r[2]);
+    MPI_Isend(data, 1, send_types[2*d+1], hi, 2*d+1, comm.MPIComm, &r[3]);
+  }
+#else
+  struct Box
+  {
+    std::vector<int> starts, sub_dims;
+  };
+  std::vector<Box> send_boxes, recv_boxes; // Down and up boundary/halo layers
+  std::vector< std::pair<int, T*> > posted; // Dimension and array of each Post awaiting its receives
+
+  Box Slab(int d, int start)
+  {
+    Box box;
+    SlabBox(d, start, box.starts, box.sub_dims);
+    return box;
+  }
+
+  // Calls f on every element of box within data, in column-major order
+  template<class F>
+  void ForBox(T* data, const Box &box, F f)
+  {
+    int n_dims = dims.size();
+    size_t count = 1;
+    for (int e=0; e<n_dims; ++e)
+      count *= box.sub_dims[e];
+    std::vector<int> index(box.starts);
+    for (size_t i=0; i<count; ++i) {
+      size_t offset = 0;
+      for (int e=n_dims-1; e>=0; --e)
+        offset = offset*dims[e] + index[e];
+      f(data[offset]);
+      for (int e=0; (e<n_dims) && (++index[e] == box.starts[e]+box.sub_dims[e]); ++e)
+        index[e] = box.starts[e];
+    }
+  }
+
+  // Sends the boundary layers of dimension d (Send never waits without MPI); Wait receives the halos
+  void Post(int d, T* data)
+  {
+    for (int side=0; side<2; ++side) {
+      std::vector<T> layer;
+      ForBox(data, send_boxes[2*d+side], [&](T &elem) { layer.push_back(elem); });
+      comm.Send(neighbors[2*d+side], layer, 2*d+side);
+    }
+    posted.push_back(std::make_pair(d, data));
+  }
+#endif
+};
+
+/** Fills the halos of a decomposed matrix
+ * @param cart_comm Cartesian communicator of up to 2 dimensions
+ * @param A Local matrix, halos included
+ * @param width Halo width
+ * @param corners Whether to fill corner halos as well as edges
+ */
+template<class T>
+void ExchangeHalos(Communicator &cart_comm, matrix::mat<T> &A, int width, bool corners=false)
+{
+#ifdef USE_ARMADILLO
+  std::vector<int> dims = {int(A.n_rows), int(A.n_cols)};
+  T* data = A.memptr();
+#endif
+#ifdef USE_EIGEN
+  std::vector<int> dims = {int(A.rows()), int(A.cols())};
+  T* data = A.data();
+#endif
+  HaloExchange<T> halo(cart_comm, dims, width, corners);
+  halo.Exchange(data);
+}
+
+/** Fills the halos of a decomposed cube
+ * @param cart_comm Cartesian communicator of up to 3 dimensions
+ * @param A Local cube, halos included
+ * @param width Halo width
+ * @param corners Whether to fill edge and corner halos as well as faces
+ */
+template<class T>
+void ExchangeHalos(Communicator &cart_comm, matrix::cube<T> &A, int width, bool corners=false)
+{
+  std::vector<int> dims = {int(A.n_rows), int(A.n_cols), int(A.n_slices)};
+#ifdef USE_ARMADILLO
+  T* data = A.memptr();
+#endif
+#ifdef USE_EIGEN
+  T* data = A.data.data();
+#endif
+  HaloExchange<T> halo(cart_comm, dims, width, corners);
+  halo.Exchange(data);
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_HALO_H_
@@ -0,0 +1,184 @@
+#ifndef SCAFFOLD_COMMUNICATION_HIERARCHICAL_H_
+#define SCAFFOLD_COMMUNICATION_HIERARCHICAL_H_
+
+#include <vector>
+#include <cstring>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Node-aware view of a communicator. Processes sharing a node form
+/// node_comm, and the first process of each node (its leader) joins
+/// leader_comm, so collectives can combine on-node before crossing the
+/// network and inter-node traffic drops by the processes-per-node factor.
+class HierarchicalCommunicator
+{
+public:
+  /** Groups the processes of t_comm by node
+   * @param t_comm All processes
+   * @param procs_per_node If positive, treat each run of this many consecutive
+   *   processes as a node instead of asking MPI which share memory
+   */
+  HierarchicalCommunicator(Communicator &t_comm, int procs_per_node=0)
+    : comm(t_comm)
+  {
+    if (procs_per_node > 0)
+      comm.Split(comm.MyProc()/procs_per_node, node_comm);
+    else
+      comm.SplitShared(node_comm);
+    node_rank = node_comm.MyProc();
+    node_size = node_comm.NumProcs();
+    is_leader = (node_rank == 0);
+
+    // Processes with equal node rank share a communicator; only the leaders' one is used
+    comm.Split(node_rank, leader_comm);
+    my_node = leader_comm.MyProc();
+    n_nodes = leader_comm.NumProcs();
+    node_comm.Broadcast(0, my_node);
+    node_comm.Broadcast(0, n_nodes);
+
+    // Map every process to its node and rank on it
+    int n_procs = comm.NumProcs();
+    matrix::vec<int> mine(2), all(2*n_procs);
+    mine(0) = my_node;
+    mine(1) = node_rank;
+    comm.AllGather(mine, all);
+    node_of.resize(n_procs);
+    node_rank_of.resize(n_procs);
+    procs_on_node.resize(n_nodes);
+    for (int proc=0; proc<n_procs; ++proc) {
+      node_of[proc] = all(2*proc);
+      node_rank_of[proc] = all(2*proc+1);
+    }
+    for (int proc=0; proc<n_procs; ++proc)
+      procs_on_node[node_of[proc]].push_back(proc);
+    for (int proc=0; proc<n_procs; ++proc)
+      procs_on_node[node_of[proc]][node_rank_of[proc]] = proc;
+  }
+
+  ~HierarchicalCommunicator()
+  {
+    leader_comm.Free();
+    node_comm.Free();
+  }
+
+  HierarchicalCommunicator(const HierarchicalCommunicator&) = delete;
+  HierarchicalCommunicator& operator=(const HierarchicalCommunicator&) = delete;
+
+  Communicator comm; // All processes
+  Communicator node_comm; // Processes on my node
+  Communicator leader_comm; // One process per node (valid on leaders only)
+  int node_rank, node_size, my_node, n_nodes;
+  bool is_leader;
+  std::vector<int> node_of; // Node of each process in comm
+  std::vector<int> node_rank_of; // Rank in node_comm of each process in comm
+  std::vector< std::vector<int> > procs_on_node; // Processes of each node, in node rank order
+
+  inline int MyProc() { return comm.MyProc(); }
+  inline int NumProcs() { return comm.NumProcs(); }
+  inline int NumNodes() { return n_nodes; }
+
+  // AllReduce: reduce onto node leaders, all-reduce across leaders, broadcast on-node
+  template<class T, class Op>
+  int AllReduce(T &from_buff, T &to_buff, Op op)
+  {
+    int status = node_comm.Reduce(0, from_buff, to_buff, op);
+    if (is_leader) {
+      T node_buff(to_buff);
+      status = leader_comm.AllReduce(node_buff, to_buff, op);
+    }
+    return node_comm.Broadcast(0, to_buff);
+  }
+
+  // AllSum
+  template<class T>
+  inline int AllSum(T &from_buff, T &to_buff)
+  {
+  #if USE_MPI
+    return AllReduce(from_buff, to_buff, MPI_SUM);
+  #else
+    return AllReduce(from_buff, to_buff, Plus<typename ElemType<T>::type>());
+  #endif
+  }
+
+  // Broadcast: hand to the root's node leader, broadcast across leaders, then on-node
+  template<class T>
+  int Broadcast(int from_proc, T &val)
+  {
+    int root_node = node_of[from_proc];
+    int root_node_rank = node_rank_of[from_proc];
+    if ((my_node == root_node) && (root_node_rank != 0)) {
+      if (node_rank == root_node_rank)
+        node_comm.Send(0, val);
+      else if (is_leader)
+        node_comm.Receive(root_node_rank, val);
+    }
+    if (is_leader)
+      leader_comm.Broadcast(root_node, val);
+    return node_comm.Broadcast(0, val);
+  }
+
+  /** Gather equal-sized buffers onto one process, in process order
+   * @param to_proc ID for receiving process
+   * @param from_buff Reference to sending buffer
+   * @param to_buff Reference to receiving buffer, sized NumProcs() times from_buff
+   * return the MPI status
+   */
+  template<class T>
+  int Gather(int to_proc, T &from_buff, T &to_buff)
+  {
+  #if USE_MPI
+    MPI_Datatype type = MPITypeTraits<T>::GetType(from_buff);
+    int count = MPITypeTraits<T>::GetSize(from_buff);
+    int type_size;
+    MPI_Type_size(type, &type_size);
+    int block = count*type_size;
+
+    // Gather onto node leaders, in node rank order
+    std::vector<char> node_buff(is_leader ? block*node_size : 0);
+    int status = MPI_Gather(MPITypeTraits<T>::GetAddr(from_buff), count, type, node_buff.data(), count, type, 0, node_comm.MPIComm);
+
+    // Gather nodes onto the leader of to_proc's node, reordering by process
+    int root_node = node_of[to_proc];
+    std::vector<char> all_buff;
+    if (is_leader) {
+      std::vector<int> recv_counts(n_nodes), displacements(n_nodes);
+      int total = 0;
+      for (int node=0; node<n_nodes; ++node) {
+        recv_counts[node] = block*procs_on_node[node].size();
+        displacements[node] = total;
+        total += recv_counts[node];
+      }
+      std::vector<char> nodes_buff(my_node == root_node ? total : 0);
+      status = MPI_Gatherv(node_buff.data(), block*node_size, MPI_BYTE, nodes_buff.data(), recv_counts.data(), displacements.data(), MPI_BYTE, root_node, leader_comm.MPIComm);
+      if (my_node == root_node) {
+        all_buff.resize(total);
+        for (int node=0; node<n_nodes; ++node)
+          for (int i=0; i<procs_on_node[node].size(); ++i)
+            memcpy(&all_buff[procs_on_node[node][i]*block], &nodes_buff[displacements[node] + i*block], block);
+      }
+    }
+
+    // Hand off from the node leader if needed
+    if (my_node == root_node) {
+      int root_node_rank = node_rank_of[to_proc];
+      if (root_node_rank == 0) {
+        if (is_leader)
+          memcpy(MPITypeTraits<T>::GetAddr(to_buff), all_buff.data(), all_buff.size());
+      } else if (is_leader)
+        status = MPI_Send(all_buff.data(), all_buff.size(), MPI_BYTE, root_node_rank, 0, node_comm.MPIComm);
+      else if (node_rank == root_node_rank)
+        status = MPI_Recv(MPITypeTraits<T>::GetAddr(to_buff), block*comm.NumProcs(), MPI_BYTE, 0, 0, node_comm.MPIComm, MPI_STATUS_IGNORE);
+    }
+    return status;
+  #else
+    // Without MPI the processes share memory already, so there is no hierarchy to exploit
+    return comm.Gather(to_proc, from_buff, to_buff);
+  #endif
+  }
+
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_HIERARCHICAL_H_
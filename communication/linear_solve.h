@@ -0,0 +1,154 @@
+#ifndef SCAFFOLD_COMMUNICATION_LINEAR_SOLVE_H_
+#define SCAFFOLD_COMMUNICATION_LINEAR_SOLVE_H_
+
+#include <vector>
+#include <algorithm>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// LU factorization computed once and shared by every process of a
+/// communicator, so each process can solve its own right-hand sides
+template<class T>
+class SharedLU
+{
+public:
+  SharedLU(Communicator &t_comm)
+    : comm(t_comm), n(0)
+  {}
+
+  Communicator comm;
+  matrix::mat<T> LU; // Packed L (unit diagonal) and U factors
+  matrix::vec<int> perm; // Row order of the pivoted matrix
+  int n;
+
+  /** Factorizes A on one process and shares the factors with all
+   * @param from_proc ID of the process holding A
+   * @param A Square matrix (only read on from_proc)
+   * return whether the factorization succeeded
+   */
+  bool Factor(int from_proc, matrix::mat<T> &A)
+  {
+    int status = 0;
+    if (comm.MyProc() == from_proc) {
+    #ifdef USE_ARMADILLO
+      n = A.n_rows;
+    #endif
+    #ifdef USE_EIGEN
+      n = A.rows();
+    #endif
+      status = matrix::lu_factor(LU, perm, A);
+    }
+    comm.Broadcast(from_proc, n);
+    comm.Broadcast(from_proc, status);
+    if (comm.MyProc() != from_proc) {
+      LU.set_size(n,n);
+      perm.set_size(n);
+    }
+    comm.Broadcast(from_proc, LU);
+    comm.Broadcast(from_proc, perm);
+    return status;
+  }
+
+  /// Solve A*X = B for locally held right-hand sides
+  inline matrix::mat<T> Solve(matrix::mat<T> &B) { return matrix::lu_solve(LU, perm, B); }
+
+  /** Solves for this process's block of the identity, giving its columns of inv(A)
+   * @param first_col First column of the block
+   * @param n_cols Number of columns in the block
+   */
+  matrix::mat<T> InverseCols(int first_col, int n_cols)
+  {
+    matrix::mat<T> B = matrix::zeros<matrix::mat<T>>(n,n_cols);
+    for (int j=0; j<n_cols; ++j)
+      B(first_col+j,j) = T(1);
+    return Solve(B);
+  }
+};
+
+/** Solves A*X = B, factorizing A once and splitting the columns of B over
+ * the processes. The full solution is allgathered onto every process.
+ * @param from_proc ID of the process holding A and B
+ * @param A Square matrix (only read on from_proc)
+ * @param B Right-hand sides (only read on from_proc)
+ * @param X Solution (resized on all processes)
+ * return whether the factorization succeeded
+ */
+template<class T>
+bool Solve(Communicator &comm, int from_proc, matrix::mat<T> &A, matrix::mat<T> &B, matrix::mat<T> &X)
+{
+  int n_procs = comm.NumProcs();
+  int my_proc = comm.MyProc();
+  SharedLU<T> lu(comm);
+  bool status = lu.Factor(from_proc, A);
+
+  // Divide up right-hand sides without needing B's shape off from_proc
+  int n_rhs = 0;
+  if (my_proc == from_proc) {
+  #ifdef USE_ARMADILLO
+    n_rhs = B.n_cols;
+  #endif
+  #ifdef USE_EIGEN
+    n_rhs = B.cols();
+  #endif
+  }
+  comm.Broadcast(from_proc, n_rhs);
+  // Counted in whole columns, so N*n_rhs may pass INT_MAX
+  std::vector<int> send_counts(n_procs), displacements(n_procs);
+  for (int proc=0; proc<n_procs; ++proc)
+    ColBlock(n_rhs, proc, n_procs, displacements[proc], send_counts[proc]);
+  int my_first_col = displacements[my_proc], my_n_cols = send_counts[my_proc];
+  matrix::mat<T> B_local(lu.n, my_n_cols);
+#if USE_MPI
+  T elem = T();
+  MPI_Datatype col_type;
+  MPI_Type_contiguous(lu.n, MPITypeTraits<T>::GetType(elem), &col_type);
+  MPI_Type_commit(&col_type);
+  void* B_addr = (my_proc == from_proc) ? MPITypeTraits< matrix::mat<T> >::GetAddr(B) : 0;
+  MPI_Scatterv(B_addr, send_counts.data(), displacements.data(), col_type,
+               MPITypeTraits< matrix::mat<T> >::GetAddr(B_local), my_n_cols, col_type, from_proc, comm.MPIComm);
+  MPI_Type_free(&col_type);
+#else
+  for (int proc=0; proc<n_procs; ++proc) {
+    send_counts[proc] *= lu.n;
+    displacements[proc] *= lu.n;
+  }
+  comm.Scatterv(from_proc, B, B_local, send_counts.data(), displacements.data());
+#endif
+
+  // Solve local columns and share
+  matrix::mat<T> X_local = lu.Solve(B_local);
+  X.set_size(lu.n, n_rhs);
+  for (int j=0; j<my_n_cols; ++j)
+    for (int i=0; i<lu.n; ++i)
+      X(i,my_first_col+j) = X_local(i,j);
+  comm.AllGatherCols(X);
+  return status;
+}
+
+/** Inverts A, factorizing it once and solving for blocks of identity columns
+ * in parallel. The full inverse is allgathered onto every process.
+ * @param from_proc ID of the process holding A
+ * @param A Square matrix (only read on from_proc)
+ * @param AI Inverse (resized on all processes)
+ * return whether the factorization succeeded
+ */
+template<class T>
+bool Inverse(Communicator &comm, int from_proc, matrix::mat<T> &A, matrix::mat<T> &AI)
+{
+  SharedLU<T> lu(comm);
+  bool status = lu.Factor(from_proc, A);
+  int my_first_col, my_n_cols;
+  ColBlock(lu.n, comm.MyProc(), comm.NumProcs(), my_first_col, my_n_cols);
+  matrix::mat<T> X_local = lu.InverseCols(my_first_col, my_n_cols);
+  AI.set_size(lu.n, lu.n);
+  for (int j=0; j<my_n_cols; ++j)
+    for (int i=0; i<lu.n; ++i)
+      AI(i,my_first_col+j) = X_local(i,j);
+  comm.AllGatherCols(AI);
+  return status;
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_LINEAR_SOLVE_H_
@@ -0,0 +1,249 @@
+#ifndef SCAFFOLD_COMMUNICATION_LOAD_BALANCE_H_
+#define SCAFFOLD_COMMUNICATION_LOAD_BALANCE_H_
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "communication.h"
+#include "sparse_exchange.h"
+
+namespace scaffold { namespace parallel {
+
+/// Redistribution of a population (e.g. walkers) spread unevenly over the
+/// processes of a communicator, moving as few walkers as possible. Each
+/// process targets an equal share, so it has either a surplus (walkers
+/// beyond its target) or a deficit. Exclusive scans of the surpluses and of
+/// the deficits lay both out along one range of excess indices, and each
+/// surplus walker goes to the process whose deficit covers its index. Only
+/// the surplus walkers move, which is the minimum, and no process learns more
+/// than its own counts: the pieces of the two layouts are matched by the
+/// processes owning equal blocks of the excess range, through sparse
+/// exchanges (sparse_exchange.h). Walkers that stay keep their order;
+/// arrivals are appended.
+class LoadBalancePlan
+{
+public:
+  /** Works out the moves (collective)
+   * @param comm Processes sharing the population
+   * @param my_count Number of walkers on this process
+   */
+  LoadBalancePlan(Communicator &comm, int my_count)
+    : count(my_count)
+  {
+    n_procs = comm.NumProcs();
+    my_proc = comm.MyProc();
+    int offset, surplus_offset, deficit_offset;
+    comm.GlobalOffset(count, offset, total);
+    target_count = total/n_procs + (my_proc < total%n_procs);
+    int surplus = std::max(0, count - target_count);
+    int deficit = std::max(0, target_count - count);
+    comm.GlobalOffset(surplus, surplus_offset, n_moved);
+    comm.GlobalOffset(deficit, deficit_offset, n_moved);
+  #if USE_MPI
+    comm.AllReduce(count, max_count, MPI_MAX);
+  #else
+    comm.AllReduce(count, max_count, Max<int>());
+  #endif
+    if (n_moved == 0)
+      return;
+
+    // Hand the pieces of my surplus (or deficit) in each block of excess indices to the block's owner
+    int block = (n_moved + n_procs - 1)/n_procs;
+    SparseMessages< matrix::vec<int> > pieces, block_pieces;
+    AddPieces(pieces, SURPLUS, surplus_offset, surplus, block);
+    AddPieces(pieces, DEFICIT, deficit_offset, deficit, block);
+    SparseExchange(comm, pieces, block_pieces);
+
+    // Both kinds of piece tile my block; match them up, telling senders and receivers
+    std::vector<Piece> in_block[2];
+    for (auto &piece: block_pieces)
+      in_block[piece.second(0)].push_back(Piece{piece.second(1), piece.second(2), piece.first});
+    SparseMessages< matrix::vec<int> > matches, my_matches;
+    std::vector<Piece> &from = Sorted(in_block[SURPLUS]), &to = Sorted(in_block[DEFICIT]);
+    for (size_t i=0, j=0; (i<from.size()) && (j<to.size()); ) {
+      int first = std::max(from[i].first, to[j].first);
+      int end = std::min(from[i].first + from[i].count, to[j].first + to[j].count);
+      matches.push_back(std::make_pair(from[i].proc, Message(SURPLUS, first, end-first, to[j].proc)));
+      matches.push_back(std::make_pair(to[j].proc, Message(DEFICIT, first, end-first, from[i].proc)));
+      i += (end == from[i].first + from[i].count);
+      j += (end == to[j].first + to[j].count);
+    }
+    SparseExchange(comm, matches, my_matches);
+
+    // My transfers in excess index order, joining pieces split by block boundaries
+    std::vector<Piece> mine[2];
+    for (auto &match: my_matches)
+      mine[match.second(0)].push_back(Piece{match.second(1), match.second(2), match.second(3)});
+    Join(Sorted(mine[SURPLUS]), sends);
+    Join(Sorted(mine[DEFICIT]), recvs);
+  }
+
+  int n_procs, my_proc;
+  int total; // Walkers over all processes
+  int n_moved; // Walkers changing process over all processes
+  int count, target_count; // Walkers on this process before and after balancing
+  int max_count; // Largest count over all processes
+  std::vector< std::pair<int, int> > sends; // Process and number of walkers sent to it, taken in order from the end of my surplus
+  std::vector< std::pair<int, int> > recvs; // Process and number of walkers received from it, appended in order
+
+  /// Walkers on this process after balancing
+  inline int TargetCount() { return target_count; }
+
+  /// Largest count over the average count (1 when balanced)
+  inline double Imbalance()
+  {
+    return total > 0 ? double(max_count)*n_procs/total : 1.;
+  }
+
+private:
+  enum { SURPLUS = 0, DEFICIT = 1 };
+
+  // Range of excess indices and the process on the other end
+  struct Piece
+  {
+    int first, count, proc;
+  };
+
+  static inline matrix::vec<int> Message(int kind, int first, int count, int proc=0)
+  {
+    matrix::vec<int> message(4);
+    message(0) = kind;
+    message(1) = first;
+    message(2) = count;
+    message(3) = proc;
+    return message;
+  }
+
+  // Splits [first, first+count) at block boundaries, addressing each piece to its block's owner
+  static void AddPieces(SparseMessages< matrix::vec<int> > &pieces, int kind, int first, int count, int block)
+  {
+    for (int end=first+count; first<end; ) {
+      int owner = first/block;
+      int piece_end = std::min(end, (owner+1)*block);
+      pieces.push_back(std::make_pair(owner, Message(kind, first, piece_end-first)));
+      first = piece_end;
+    }
+  }
+
+  static std::vector<Piece>& Sorted(std::vector<Piece> &pieces)
+  {
+    std::sort(pieces.begin(), pieces.end(), [](const Piece &a, const Piece &b) { return a.first < b.first; });
+    return pieces;
+  }
+
+  // Sums the counts of consecutive pieces with the same process
+  static void Join(std::vector<Piece> &pieces, std::vector< std::pair<int, int> > &transfers)
+  {
+    for (auto &piece: pieces) {
+      if (!transfers.empty() && (transfers.back().first == piece.proc))
+        transfers.back().second += piece.count;
+      else
+        transfers.push_back(std::make_pair(piece.proc, piece.count));
+    }
+  }
+};
+
+/** Balances walkers stored as matrices (of any shape) over the processes of
+ * comm, moving only the surplus walkers (see LoadBalancePlan). Each message
+ * to a process carries a header with every walker's shape, then their data;
+ * both go non-blocking. Without MPI each process's walkers go as one
+ * serialized message (see serialize.h).
+ * @param comm Processes sharing the population
+ * @param walkers This process's walkers: surplus ones are taken from the end,
+ *   arrivals appended
+ * return the number of walkers that changed process
+ */
+template<class T>
+int LoadBalance(Communicator &comm, std::vector< matrix::mat<T> > &walkers)
+{
+  LoadBalancePlan plan(comm, walkers.size());
+#if USE_MPI
+  if (plan.n_moved == 0)
+    return 0;
+  T elem = T();
+  MPI_Datatype type = MPITypeTraits<T>::GetType(elem);
+  enum { HEADER_TAG = 7401, DATA_TAG = 7402 };
+  std::vector<MPI_Request> requests;
+
+  // Post header receives first, to size the data
+  std::vector< std::vector<int> > recv_headers(plan.recvs.size());
+  std::vector<MPI_Request> header_requests(plan.recvs.size(), MPI_REQUEST_NULL);
+  for (size_t k=0; k<plan.recvs.size(); ++k) {
+    recv_headers[k].resize(2*plan.recvs[k].second);
+    MPI_Irecv(recv_headers[k].data(), recv_headers[k].size(), MPI_INT, plan.recvs[k].first, HEADER_TAG, comm.MPIComm, &header_requests[k]);
+  }
+
+  // Pack headers (rows, cols per walker) and data of the surplus, in order, per destination
+  std::vector< std::vector<int> > send_headers(plan.sends.size());
+  std::vector< std::vector<T> > send_data(plan.sends.size());
+  int first = plan.target_count;
+  for (size_t k=0; k<plan.sends.size(); ++k) {
+    for (int i=first; i<first+plan.sends[k].second; ++i) {
+    #ifdef USE_ARMADILLO
+      int rows = walkers[i].n_rows, cols = walkers[i].n_cols;
+    #endif
+    #ifdef USE_EIGEN
+      int rows = walkers[i].rows(), cols = walkers[i].cols();
+    #endif
+      send_headers[k].push_back(rows);
+      send_headers[k].push_back(cols);
+      T* addr = static_cast<T*>(MPITypeTraits< matrix::mat<T> >::GetAddr(walkers[i]));
+      send_data[k].insert(send_data[k].end(), addr, addr + size_t(rows)*cols);
+    }
+    first += plan.sends[k].second;
+    requests.push_back(MPI_REQUEST_NULL);
+    MPI_Isend(send_headers[k].data(), send_headers[k].size(), MPI_INT, plan.sends[k].first, HEADER_TAG, comm.MPIComm, &requests.back());
+    requests.push_back(MPI_REQUEST_NULL);
+    MPI_Isend(send_data[k].data(), send_data[k].size(), type, plan.sends[k].first, DATA_TAG, comm.MPIComm, &requests.back());
+  }
+  if (!plan.sends.empty())
+    walkers.resize(plan.target_count);
+
+  std::vector< std::vector<T> > recv_data(plan.recvs.size());
+  for (size_t k=0; k<plan.recvs.size(); ++k) {
+    MPI_Wait(&header_requests[k], MPI_STATUS_IGNORE);
+    size_t size = 0;
+    for (int i=0; i<plan.recvs[k].second; ++i)
+      size += size_t(recv_headers[k][2*i])*recv_headers[k][2*i+1];
+    recv_data[k].resize(size);
+    requests.push_back(MPI_REQUEST_NULL);
+    MPI_Irecv(recv_data[k].data(), size, type, plan.recvs[k].first, DATA_TAG, comm.MPIComm, &requests.back());
+  }
+  MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+  // Append arrivals in excess index order
+  walkers.reserve(plan.target_count);
+  for (size_t k=0; k<plan.recvs.size(); ++k) {
+    size_t pos = 0;
+    for (int i=0; i<plan.recvs[k].second; ++i) {
+      int rows = recv_headers[k][2*i], cols = recv_headers[k][2*i+1];
+      walkers.push_back(matrix::mat<T>(rows, cols));
+      memcpy(MPITypeTraits< matrix::mat<T> >::GetAddr(walkers.back()), &recv_data[k][pos], size_t(rows)*cols*sizeof(T));
+      pos += size_t(rows)*cols;
+    }
+  }
+#else
+  if (plan.n_moved == 0)
+    return 0;
+  enum { WALKERS_TAG = 7401 };
+  int first = plan.target_count;
+  for (auto &send: plan.sends) {
+    std::vector< matrix::mat<T> > batch(walkers.begin() + first, walkers.begin() + first + send.second);
+    comm.Send(send.first, batch, WALKERS_TAG);
+    first += send.second;
+  }
+  if (!plan.sends.empty())
+    walkers.resize(plan.target_count);
+  walkers.reserve(plan.target_count);
+  for (auto &recv: plan.recvs) {
+    std::vector< matrix::mat<T> > batch;
+    comm.Receive(recv.first, batch, WALKERS_TAG);
+    walkers.insert(walkers.end(), batch.begin(), batch.end());
+  }
+#endif
+  return plan.n_moved;
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_LOAD_BALANCE_H_
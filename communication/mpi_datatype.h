@@ -11,6 +11,31 @@
 
 namespace scaffold { namespace parallel {
 
+// Resizing of receive buffers to a probed element count. Scalars must
+// already match; matrices keep their row count when it divides n and
+// otherwise become a column.
+template<class T>
+inline bool ResizeToCount(T &val, size_t n) { return n == 1; }
+template<class T>
+inline bool ResizeToCount(matrix::mat<T> &val, size_t n)
+{
+#ifdef USE_ARMADILLO
+  size_t rows = ((val.n_rows > 0) && (n%val.n_rows == 0)) ? val.n_rows : n;
+  val.set_size(rows, rows > 0 ? n/rows : 0);
+#endif
+#ifdef USE_EIGEN
+  size_t rows = ((val.rows() > 0) && (n%val.rows() == 0)) ? val.rows() : n;
+  val.resize(rows, rows > 0 ? n/rows : 0);
+#endif
+  return true;
+}
+template<class T>
+inline bool ResizeToCount(matrix::vec<T> &val, size_t n)
+{
+  val.set_size(n);
+  return true;
+}
+
 #if USE_MPI
 // Template to retrieve traits of any MPI object
 template <class T>
@@ -90,8 +115,32 @@ struct MPITypeTraits {
   #undef EIGENTYPE
 #endif
 
+// Contiguous bytes of a plain-old-data struct, committed once per type
+inline MPI_Datatype PODType(size_t size)
+{
+  MPI_Datatype type;
+  MPI_Type_contiguous(size, MPI_BYTE, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
 #endif
 
 }} // namespace
 
+// Specialization of MPITypeTraits for a plain-old-data struct, used at global
+// scope. Such values only move between processes with the same layout, and
+// reduce with user ops (see reduce_op.h).
+#if USE_MPI
+  #define SCAFFOLD_MPI_POD_TYPE(...) \
+          template<> \
+          inline MPI_Datatype scaffold::parallel::MPITypeTraits<__VA_ARGS__>::GetType(__VA_ARGS__&) { static MPI_Datatype type = scaffold::parallel::PODType(sizeof(__VA_ARGS__)); return type; } \
+          template<> \
+          inline size_t scaffold::parallel::MPITypeTraits<__VA_ARGS__>::GetSize(__VA_ARGS__&) { return 1; } \
+          template<> \
+          inline void* scaffold::parallel::MPITypeTraits<__VA_ARGS__>::GetAddr(__VA_ARGS__& val) { return &val; }
+#else
+  #define SCAFFOLD_MPI_POD_TYPE(...)
+#endif
+
 #endif // SCAFFOLD_COMMUNICATION_MPI_DATATYPE_H_
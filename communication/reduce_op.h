@@ -0,0 +1,221 @@
+#ifndef SCAFFOLD_COMMUNICATION_REDUCE_OP_H_
+#define SCAFFOLD_COMMUNICATION_REDUCE_OP_H_
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+#include "mpi_datatype.h"
+
+namespace scaffold { namespace parallel {
+
+// Reduction functors combine one element into another, inout = in (op) inout,
+// and name their element type value_type. Pass them to Communicator::Reduce
+// or AllReduce in place of an MPI_Op; the element type needs MPITypeTraits
+// (see SCAFFOLD_MPI_POD_TYPE for structs).
+
+/// Element type of a buffer: the type itself, or that of a matrix or vector
+template<class T> struct ElemType { typedef T type; };
+template<class T> struct ElemType< matrix::mat<T> > { typedef T type; };
+template<class T> struct ElemType< matrix::vec<T> > { typedef T type; };
+template<class T, class A> struct ElemType< std::vector<T,A> > { typedef T type; };
+
+/// Fails to compile unless functor F combines elements of buffers of type T
+template<class F, class T>
+inline void CheckReduceOp()
+{
+  static_assert(std::is_same<typename F::value_type, typename ElemType<T>::type>::value,
+                "Reduction functor's value_type differs from the buffer's element type");
+}
+
+#if USE_MPI
+/// MPI_Op wrapping a reduction functor, created on first use (after MPI_Init)
+template<class F, bool commute=true>
+struct UserOp
+{
+  static void Apply(void *in, void *inout, int *len, MPI_Datatype *type)
+  {
+    typedef typename F::value_type V;
+    V *in_vals = static_cast<V*>(in);
+    V *inout_vals = static_cast<V*>(inout);
+    F op;
+    for (int i=0; i<*len; ++i)
+      op(in_vals[i], inout_vals[i]);
+  }
+
+  static MPI_Op Get()
+  {
+    static MPI_Op op = Create();
+    return op;
+  }
+
+private:
+  static MPI_Op Create()
+  {
+    MPI_Op op;
+    MPI_Op_create(&UserOp::Apply, commute, &op);
+    return op;
+  }
+};
+#endif
+
+// Element-wise arithmetic, for backends without MPI's built-in operations
+template<class T>
+struct Plus { typedef T value_type; inline void operator()(const T &in, T &inout) const { inout += in; } };
+template<class T>
+struct Times { typedef T value_type; inline void operator()(const T &in, T &inout) const { inout *= in; } };
+template<class T>
+struct Max { typedef T value_type; inline void operator()(const T &in, T &inout) const { if (in > inout) inout = in; } };
+template<class T>
+struct Min { typedef T value_type; inline void operator()(const T &in, T &inout) const { if (in < inout) inout = in; } };
+
+/// Value with the location (e.g. process or index) it came from
+template<class T>
+struct ValueLoc
+{
+  T value;
+  int loc;
+};
+
+// MinLoc (lowest location wins ties)
+template<class T>
+struct MinLoc
+{
+  typedef ValueLoc<T> value_type;
+  inline void operator()(const value_type &in, value_type &inout) const
+  {
+    if ((in.value < inout.value) || ((in.value == inout.value) && (in.loc < inout.loc)))
+      inout = in;
+  }
+};
+
+// MaxLoc (lowest location wins ties)
+template<class T>
+struct MaxLoc
+{
+  typedef ValueLoc<T> value_type;
+  inline void operator()(const value_type &in, value_type &inout) const
+  {
+    if ((in.value > inout.value) || ((in.value == inout.value) && (in.loc < inout.loc)))
+      inout = in;
+  }
+};
+
+/// Compensated (Kahan-Babuska) running sum
+struct KahanValue
+{
+  double sum, c;
+
+  KahanValue() : sum(0.), c(0.) {}
+
+  inline void Add(double x)
+  {
+    double t = sum + x;
+    if (std::abs(sum) >= std::abs(x))
+      c += (sum - t) + x;
+    else
+      c += (x - t) + sum;
+    sum = t;
+  }
+
+  inline double Value() const { return sum + c; }
+};
+
+// KahanSum
+struct KahanSum
+{
+  typedef KahanValue value_type;
+  inline void operator()(const value_type &in, value_type &inout) const
+  {
+    double c = inout.c + in.c;
+    inout.c = 0.;
+    inout.Add(in.sum);
+    inout.c += c;
+  }
+};
+
+/// Count, mean and summed squared deviations of a sample (Welford)
+struct Moments
+{
+  double n, mean, m2;
+
+  Moments() : n(0.), mean(0.), m2(0.) {}
+
+  inline void Add(double x)
+  {
+    n += 1.;
+    double delta = x - mean;
+    mean += delta/n;
+    m2 += delta*(x - mean);
+  }
+
+  inline double Variance() const { return n > 1. ? m2/(n-1.) : 0.; }
+};
+
+// MomentsMerge (Chan et al. pairwise update)
+struct MomentsMerge
+{
+  typedef Moments value_type;
+  inline void operator()(const value_type &in, value_type &inout) const
+  {
+    if (in.n == 0.)
+      return;
+    double n = in.n + inout.n;
+    double delta = in.mean - inout.mean;
+    inout.mean += delta*in.n/n;
+    inout.m2 += in.m2 + delta*delta*in.n*inout.n/n;
+    inout.n = n;
+  }
+};
+
+/// Fixed-binning histogram over [lo, hi), with out-of-range counts. NaN
+/// samples are not counted anywhere.
+template<int N_BINS>
+struct Histogram
+{
+  double lo, hi;
+  double counts[N_BINS];
+  double n_under, n_over;
+
+  Histogram(double t_lo=0., double t_hi=1.)
+    : lo(t_lo), hi(t_hi), n_under(0.), n_over(0.)
+  {
+    for (int i=0; i<N_BINS; ++i)
+      counts[i] = 0.;
+  }
+
+  inline void Add(double x, double weight=1.)
+  {
+    if (std::isnan(x))
+      return;
+    if (x < lo)
+      n_under += weight;
+    else if (x >= hi)
+      n_over += weight;
+    else // Rounding can reach N_BINS just below hi
+      counts[std::min(std::max(int(N_BINS*(x-lo)/(hi-lo)), 0), N_BINS-1)] += weight;
+  }
+};
+
+// HistogramMerge (histograms must share their binning)
+template<int N_BINS>
+struct HistogramMerge
+{
+  typedef Histogram<N_BINS> value_type;
+  inline void operator()(const value_type &in, value_type &inout) const
+  {
+    for (int i=0; i<N_BINS; ++i)
+      inout.counts[i] += in.counts[i];
+    inout.n_under += in.n_under;
+    inout.n_over += in.n_over;
+  }
+};
+
+}}
+
+SCAFFOLD_MPI_POD_TYPE(scaffold::parallel::ValueLoc<int>);
+SCAFFOLD_MPI_POD_TYPE(scaffold::parallel::ValueLoc<double>);
+SCAFFOLD_MPI_POD_TYPE(scaffold::parallel::KahanValue);
+SCAFFOLD_MPI_POD_TYPE(scaffold::parallel::Moments);
+
+#endif // SCAFFOLD_COMMUNICATION_REDUCE_OP_H_
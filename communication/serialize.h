@@ -0,0 +1,289 @@
+#ifndef SCAFFOLD_COMMUNICATION_SERIALIZE_H_
+#define SCAFFOLD_COMMUNICATION_SERIALIZE_H_
+
+// Packing of composite objects (std::string, std::vector, std::map,
+// matrix::field, io::Node and nestings of these) into byte buffers, so they
+// can move through Communicator in one message. Sizes are computed first,
+// so packing never reallocates, and buffers come from a reusable pool.
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <complex>
+#include <type_traits>
+#include <mutex>
+#include "mpi_datatype.h"
+#include "../io/io_xml.h"
+
+namespace scaffold { namespace parallel {
+
+/// Whether a type maps onto a single MPI datatype buffer (see MPITypeTraits),
+/// rather than needing serialization
+template<class T> struct HasMPIType : std::true_type {};
+template<> struct HasMPIType<std::string> : std::false_type {};
+template<class T, class A> struct HasMPIType< std::vector<T,A> > : std::false_type {};
+template<class K, class V, class C, class A> struct HasMPIType< std::map<K,V,C,A> > : std::false_type {};
+template<class T> struct HasMPIType< matrix::field<T> > : std::false_type {};
+template<> struct HasMPIType<io::Node> : std::false_type {};
+
+/// Whether values are stored as plain bytes
+template<class T> struct IsBitwise : std::is_arithmetic<T> {};
+template<class T> struct IsBitwise< std::complex<T> > : std::is_arithmetic<T> {};
+
+// Archive counting bytes
+class SizeArchive
+{
+public:
+  SizeArchive() : size(0) {}
+  static const bool loading = false;
+  size_t size;
+  template<class T>
+  inline void Bytes(const T* val, size_t n) { size += n*sizeof(T); }
+};
+
+// Archive writing into a buffer sized by SizeArchive
+class PackArchive
+{
+public:
+  PackArchive(char* t_pos) : pos(t_pos) {}
+  static const bool loading = false;
+  char* pos;
+  template<class T>
+  inline void Bytes(const T* val, size_t n)
+  {
+    memcpy(pos, val, n*sizeof(T));
+    pos += n*sizeof(T);
+  }
+};
+
+// Archive reading back from a buffer
+class UnpackArchive
+{
+public:
+  UnpackArchive(const char* t_pos) : pos(t_pos) {}
+  static const bool loading = true;
+  const char* pos;
+  template<class T>
+  inline void Bytes(T* val, size_t n)
+  {
+    memcpy(val, pos, n*sizeof(T));
+    pos += n*sizeof(T);
+  }
+};
+
+// Primitives
+template<class Ar, class T>
+inline typename std::enable_if<IsBitwise<T>::value>::type Serialize(Ar &ar, T &val) { ar.Bytes(&val, 1); }
+
+// Arrays, in bulk when possible
+template<class Ar, class T>
+inline typename std::enable_if<IsBitwise<T>::value>::type SerializeArray(Ar &ar, T* val, size_t n) { ar.Bytes(val, n); }
+template<class Ar, class T>
+inline typename std::enable_if<!IsBitwise<T>::value>::type SerializeArray(Ar &ar, T* val, size_t n)
+{
+  for (size_t i=0; i<n; ++i)
+    Serialize(ar, val[i]);
+}
+
+// Sizes of containers
+template<class Ar>
+inline size_t SerializeSize(Ar &ar, size_t n)
+{
+  ar.Bytes(&n, 1);
+  return n;
+}
+
+// std::string
+template<class Ar>
+void Serialize(Ar &ar, std::string &val)
+{
+  size_t n = SerializeSize(ar, val.size());
+  if (Ar::loading)
+    val.resize(n);
+  if (n > 0)
+    ar.Bytes(&val[0], n);
+}
+
+// std::vector
+template<class Ar, class T, class A>
+void Serialize(Ar &ar, std::vector<T,A> &val)
+{
+  size_t n = SerializeSize(ar, val.size());
+  if (Ar::loading)
+    val.resize(n);
+  if (n > 0)
+    SerializeArray(ar, &val[0], n);
+}
+
+// std::map
+template<class Ar, class K, class V, class C, class A>
+void Serialize(Ar &ar, std::map<K,V,C,A> &val)
+{
+  size_t n = SerializeSize(ar, val.size());
+  if (Ar::loading) {
+    val.clear();
+    for (size_t i=0; i<n; ++i) {
+      K key;
+      Serialize(ar, key);
+      Serialize(ar, val[key]);
+    }
+  } else
+    for (auto &entry: val) {
+      Serialize(ar, const_cast<K&>(entry.first)); // Only read when saving
+      Serialize(ar, entry.second);
+    }
+}
+
+// matrix::mat
+template<class Ar, class T>
+void Serialize(Ar &ar, matrix::mat<T> &val)
+{
+#ifdef USE_ARMADILLO
+  size_t rows = SerializeSize(ar, val.n_rows), cols = SerializeSize(ar, val.n_cols);
+  if (Ar::loading)
+    val.set_size(rows, cols);
+  SerializeArray(ar, val.memptr(), rows*cols);
+#endif
+#ifdef USE_EIGEN
+  size_t rows = SerializeSize(ar, val.rows()), cols = SerializeSize(ar, val.cols());
+  if (Ar::loading)
+    val.resize(rows, cols);
+  SerializeArray(ar, val.data(), rows*cols);
+#endif
+}
+
+// matrix::vec
+template<class Ar, class T>
+void Serialize(Ar &ar, matrix::vec<T> &val)
+{
+  size_t n = SerializeSize(ar, val.size());
+  if (Ar::loading)
+    val.set_size(n);
+#ifdef USE_ARMADILLO
+  SerializeArray(ar, val.memptr(), n);
+#endif
+#ifdef USE_EIGEN
+  SerializeArray(ar, val.data(), n);
+#endif
+}
+
+// matrix::field
+template<class Ar, class T>
+void Serialize(Ar &ar, matrix::field<T> &val)
+{
+#ifdef USE_ARMADILLO
+  size_t rows = SerializeSize(ar, val.n_rows), cols = SerializeSize(ar, val.n_cols);
+  if (Ar::loading)
+    val.set_size(rows, cols);
+  for (size_t i=0; i<val.n_elem; ++i)
+    Serialize(ar, val(i));
+#endif
+#ifdef USE_EIGEN
+  size_t dim = SerializeSize(ar, val.dim), rows = SerializeSize(ar, val.n_rows), cols = SerializeSize(ar, val.n_cols);
+  if (Ar::loading) {
+    if (dim == 1)
+      val.set_size(rows);
+    else
+      val.set_size(rows, cols);
+  }
+  for (size_t i=0; i<rows; ++i) {
+    if (dim == 1)
+      Serialize(ar, val(i));
+    else
+      for (size_t j=0; j<cols; ++j)
+        Serialize(ar, val(i,j));
+  }
+#endif
+}
+
+// io::Node
+template<class Ar>
+void Serialize(Ar &ar, io::Node &val)
+{
+  Serialize(ar, val.name);
+  Serialize(ar, val.attributes);
+  Serialize(ar, val.child_nodes);
+}
+
+/// Bytes taken by a packed value
+template<class T>
+inline size_t PackedSize(T &val)
+{
+  SizeArchive ar;
+  Serialize(ar, val);
+  return ar.size;
+}
+
+/// Packs a value into buff, sized exactly to fit
+template<class T>
+inline void Pack(T &val, std::vector<char> &buff)
+{
+  buff.resize(PackedSize(val));
+  PackArchive ar(buff.data());
+  Serialize(ar, val);
+}
+
+/// Unpacks a value from buff
+template<class T>
+inline void Unpack(const std::vector<char> &buff, T &val)
+{
+  UnpackArchive ar(buff.data());
+  Serialize(ar, val);
+}
+
+/// Reusable byte buffers, so repeated messages reuse their allocations
+class BufferPool
+{
+public:
+  static BufferPool& Get()
+  {
+    static BufferPool pool;
+    return pool;
+  }
+
+  // Most buffers kept for reuse
+  enum { MAX_BUFFERS = 16 };
+
+  /// A buffer with whatever capacity it kept from earlier use
+  std::vector<char> Acquire()
+  {
+    std::vector<char> buff;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!free_buffers.empty()) {
+      buff.swap(free_buffers.back());
+      free_buffers.pop_back();
+    }
+    return buff;
+  }
+
+  void Release(std::vector<char> &buff)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_buffers.size() < MAX_BUFFERS) {
+      free_buffers.push_back(std::vector<char>());
+      free_buffers.back().swap(buff);
+    }
+  }
+
+private:
+  BufferPool() {}
+  std::mutex mutex; // Shared by OpenMP and std::thread users alike
+  std::vector< std::vector<char> > free_buffers;
+};
+
+/// Buffer borrowed from the pool for its lifetime
+class PooledBuffer
+{
+public:
+  PooledBuffer() : buff(BufferPool::Get().Acquire()) {}
+  ~PooledBuffer() { BufferPool::Get().Release(buff); }
+  PooledBuffer(const PooledBuffer&) = delete;
+  PooledBuffer& operator=(const PooledBuffer&) = delete;
+  std::vector<char> buff;
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_SERIALIZE_H_
@@ -0,0 +1,88 @@
+#ifndef SCAFFOLD_COMMUNICATION_SHARED_MEMORY_H_
+#define SCAFFOLD_COMMUNICATION_SHARED_MEMORY_H_
+
+#include <memory>
+#include <vector>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Matrix held once per node in an MPI shared-memory window, for large
+/// read-only tables. Every process of the node communicator sees the same
+/// memory through Mat(). The owner (node rank 0) fills it, then all call
+/// Fence() before reading. Without MPI the owner's own storage is shared.
+template<class T>
+class SharedMat
+{
+public:
+  /** Allocates the node's copy
+   * @param t_node_comm Processes sharing a node (see Communicator::SplitShared)
+   * @param n_rows Number of rows
+   * @param n_cols Number of columns
+   */
+  SharedMat(Communicator &t_node_comm, int n_rows, int n_cols)
+    : node_comm(t_node_comm)
+  {
+    T* ptr;
+  #if USE_MPI
+    node_comm.AllocateShared(size_t(n_rows)*n_cols, ptr, win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+  #else
+    if (IsOwner())
+      storage.resize(size_t(n_rows)*n_cols);
+    ptr = storage.data();
+    node_comm.Broadcast(0, ptr);
+  #endif
+  #ifdef USE_ARMADILLO
+    view.reset(new matrix::mat_view<T>(ptr, n_rows, n_cols, false, true));
+  #endif
+  #ifdef USE_EIGEN
+    view.reset(new matrix::mat_view<T>(ptr, n_rows, n_cols));
+  #endif
+  }
+
+  ~SharedMat()
+  {
+    view.reset();
+  #if USE_MPI
+    MPI_Win_unlock_all(win);
+    node_comm.FreeShared(win);
+  #else
+    node_comm.BarrierSync(); // The owner's storage goes once nobody reads it
+  #endif
+  }
+
+  SharedMat(const SharedMat&) = delete;
+  SharedMat& operator=(const SharedMat&) = delete;
+
+  /// Whether this process should fill the shared memory
+  inline bool IsOwner() { return node_comm.MyProc() == 0; }
+
+  /// The shared matrix
+  inline matrix::mat_view<T>& Mat() { return *view; }
+
+  /// Makes writes by the owner visible to every process of the node
+  void Fence()
+  {
+  #if USE_MPI
+    MPI_Win_sync(win);
+    node_comm.BarrierSync();
+    MPI_Win_sync(win);
+  #else
+    node_comm.BarrierSync();
+  #endif
+  }
+
+private:
+  Communicator node_comm;
+  std::unique_ptr<matrix::mat_view<T>> view;
+#if USE_MPI
+  MPI_Win win;
+#else
+  std::vector<T> storage;
+#endif
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_SHARED_MEMORY_H_
@@ -0,0 +1,137 @@
+#ifndef SCAFFOLD_COMMUNICATION_SPARSE_EXCHANGE_H_
+#define SCAFFOLD_COMMUNICATION_SPARSE_EXCHANGE_H_
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Messages of a sparse exchange, each with its destination (or source) process
+template<class T>
+using SparseMessages = std::vector< std::pair<int, T> >;
+
+#if USE_MPI
+// Starts a synchronous send of a contiguous buffer
+template<class T>
+void SparseSend(Communicator &comm, int to_proc, T &val, std::vector<char> &packed, int tag, MPI_Request *request, std::true_type)
+{
+  size_t size = MPITypeTraits<T>::GetSize(val);
+  if (size > Communicator::MaxCount()) {
+    std::cerr << "ERROR: SparseExchange messages take at most MaxCount() elements!" << std::endl;
+    abort();
+  }
+  MPI_Issend(MPITypeTraits<T>::GetAddr(val), size, MPITypeTraits<T>::GetType(val), to_proc, tag, comm.MPIComm, request);
+}
+
+// Starts a synchronous send of a composite value, packed into packed
+template<class T>
+void SparseSend(Communicator &comm, int to_proc, T &val, std::vector<char> &packed, int tag, MPI_Request *request, std::false_type)
+{
+  Pack(val, packed);
+  if (packed.size() > INT_MAX) {
+    std::cerr << "ERROR: Serialized message exceeds INT_MAX bytes!" << std::endl;
+    abort();
+  }
+  MPI_Issend(packed.data(), packed.size(), MPI_BYTE, to_proc, tag, comm.MPIComm, request);
+}
+
+// Receives a probed message into a buffer resized to fit
+template<class T>
+void SparseReceive(MPI_Message &message, MPI_Status &status, T &val, std::true_type)
+{
+  MPI_Datatype type = MPITypeTraits<T>::GetType(val);
+  int count;
+  MPI_Get_count(&status, type, &count);
+  if ((count == MPI_UNDEFINED) || !ResizeToCount(val, count)) {
+    std::cerr << "ERROR: Received message does not fit the receive type!" << std::endl;
+    abort();
+  }
+  MPI_Mrecv(MPITypeTraits<T>::GetAddr(val), count, type, &message, MPI_STATUS_IGNORE);
+}
+
+// Receives and unpacks a probed composite value
+template<class T>
+void SparseReceive(MPI_Message &message, MPI_Status &status, T &val, std::false_type)
+{
+  int size;
+  MPI_Get_count(&status, MPI_BYTE, &size);
+  PooledBuffer packed;
+  packed.buff.resize(size);
+  MPI_Mrecv(packed.buff.data(), size, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+  Unpack(packed.buff, val);
+}
+#endif
+
+/** Sends each message to its process and receives whatever the other
+ * processes send to this one, without anyone knowing who sends to them
+ * (the NBX algorithm of Hoefler et al.). Messages go as synchronous
+ * non-blocking sends, so one completing means it has been received; once
+ * all of a process's sends complete it enters a non-blocking barrier, and
+ * the barrier completing means every message everywhere has arrived. Each
+ * process only talks to its actual peers, so there is no O(P) count
+ * exchange. Payloads are resized to fit (see ResizeToCount), and composite
+ * types go serialized. Calls alternate between two tags (see
+ * Communicator::NextEpoch): a process leaving a call early may start sending
+ * the next call's messages while its peers still probe for this one's, but
+ * cannot finish that next call, and so reuse this tag, until they all have.
+ * @param comm Processes taking part (collective)
+ * @param sends Destination process and payload of each message
+ * @param recvs Source process and payload of each message received, appended
+ *   in arrival order
+ * @param tag First of the two tags reserved for exchanges
+ */
+template<class T>
+void SparseExchange(Communicator &comm, SparseMessages<T> &sends, SparseMessages<T> &recvs, int tag=7501)
+{
+#if USE_MPI
+  tag += comm.NextEpoch() % 2;
+  std::vector<MPI_Request> send_requests(sends.size(), MPI_REQUEST_NULL);
+  std::vector< std::vector<char> > packed(sends.size());
+  for (size_t i=0; i<sends.size(); ++i)
+    SparseSend(comm, sends[i].first, sends[i].second, packed[i], tag, &send_requests[i], HasMPIType<T>());
+
+  // Once the barrier completes every message for this process has been received
+  MPI_Request barrier = MPI_REQUEST_NULL;
+  while (true) {
+    int flag;
+    if (barrier != MPI_REQUEST_NULL) {
+      MPI_Test(&barrier, &flag, MPI_STATUS_IGNORE);
+      if (flag)
+        break;
+    }
+    MPI_Message message;
+    MPI_Status status;
+    MPI_Improbe(MPI_ANY_SOURCE, tag, comm.MPIComm, &flag, &message, &status);
+    if (flag) {
+      recvs.push_back(std::make_pair(status.MPI_SOURCE, T()));
+      SparseReceive(message, status, recvs.back().second, HasMPIType<T>());
+    }
+    if (barrier == MPI_REQUEST_NULL) {
+      MPI_Testall(send_requests.size(), send_requests.data(), &flag, MPI_STATUSES_IGNORE);
+      if (flag)
+        MPI_Ibarrier(comm.MPIComm, &barrier);
+    }
+  }
+#else
+  // Without MPI, Send has copied each message into its receiver's mailbox by
+  // the time it returns, so after a barrier every message has arrived
+  tag += comm.NextEpoch() % 2;
+  for (auto &send: sends)
+    if (send.first == comm.MyProc())
+      recvs.push_back(send);
+    else
+      comm.Send(send.first, send.second, tag);
+  comm.BarrierSync();
+  int source;
+  while (comm.IProbe(Communicator::ANY_SOURCE, tag, source)) {
+    recvs.push_back(std::make_pair(source, T()));
+    comm.ReceiveResize(source, recvs.back().second, tag);
+  }
+#endif
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_SPARSE_EXCHANGE_H_
@@ -0,0 +1,260 @@
+#ifndef SCAFFOLD_COMMUNICATION_TASK_FARM_H_
+#define SCAFFOLD_COMMUNICATION_TASK_FARM_H_
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Dynamic master-worker scheduling of independent tasks 0,...,n_tasks-1
+/// with uneven costs. A master process hands out batches of batch_size
+/// tasks on request, and each worker keeps prefetch extra requests in
+/// flight so its next batch is ready when the current one finishes. With
+/// procs_per_master set, workers are split into groups, each served by a
+/// sub-master that draws larger chunks from the top master, so no single
+/// process handles every request. Masters only schedule; they do no tasks.
+class TaskFarm
+{
+public:
+  /** Sets up the farm
+   * @param t_comm Processes taking part (all must call Run)
+   * @param t_batch_size Tasks handed out per request
+   * @param t_prefetch Requests each worker keeps queued beyond its current batch
+   * @param t_procs_per_master Processes per sub-master group, or 0 for a single master
+   */
+  TaskFarm(Communicator &t_comm, int t_batch_size=1, int t_prefetch=1, int t_procs_per_master=0)
+    : comm(t_comm), batch_size(std::max(1,t_batch_size)), prefetch(std::max(0,t_prefetch)), procs_per_master(t_procs_per_master)
+  {}
+
+  Communicator comm;
+  int batch_size, prefetch, procs_per_master;
+
+  /** Runs work(task) once for every task, spread over the workers (collective)
+   * @param n_tasks Number of tasks
+   * @param work Functor called with each task index
+   * return the number of tasks done by this process
+   */
+  template<class F>
+  int Run(int n_tasks, F work)
+  {
+    int n_procs = comm.NumProcs();
+    int my_proc = comm.MyProc();
+    if (n_procs == 1) {
+      for (int task=0; task<n_tasks; ++task)
+        work(task);
+      return n_tasks;
+    }
+
+    TaskPool pool(0, n_tasks);
+    int n_done = 0;
+
+    // Single master
+    if ((procs_per_master < 2) || (procs_per_master+1 >= n_procs)) {
+      if (my_proc == 0)
+        Serve(comm, prefetch+1, [&](int range[2]) { return pool.Take(batch_size, range); });
+      else
+        n_done = Work(comm, work);
+      return n_done;
+    }
+
+    // Top master on process 0, then groups of at least procs_per_master led by a sub-master
+    int n_groups = (n_procs-1)/procs_per_master;
+    int group = (my_proc == 0) ? 0 : std::min((my_proc-1)/procs_per_master, n_groups-1) + 1;
+    Communicator group_comm, leader_comm;
+    comm.Split(group, group_comm);
+    bool is_leader = (group_comm.MyProc() == 0);
+    comm.Split(is_leader ? 0 : 1, leader_comm);
+    if (my_proc == 0)
+      Serve(leader_comm, 1, [&](int range[2]) { return pool.Take(batch_size*procs_per_master, range); });
+    else if (is_leader) {
+      TaskPool chunk(0, 0);
+      bool exhausted = false;
+      Serve(group_comm, prefetch+1, [&](int range[2]) {
+        while (!chunk.Take(batch_size, range)) {
+          if (exhausted)
+            return false;
+          int next[2];
+          Request(leader_comm, 0, next);
+          exhausted = (next[1] == 0);
+          chunk = TaskPool(next[0], next[0]+next[1]);
+        }
+        return true;
+      });
+    } else
+      n_done = Work(group_comm, work);
+    group_comm.Free();
+    leader_comm.Free();
+    return n_done;
+  }
+
+private:
+  enum { REQUEST_TAG = 7301, REPLY_TAG = 7302 };
+
+  // Contiguous tasks not yet handed out
+  struct TaskPool
+  {
+    TaskPool(int t_next, int t_end) : next(t_next), end(t_end) {}
+    int next, end;
+
+    // Takes up to n tasks as {first, count}, false once empty
+    bool Take(int n, int range[2])
+    {
+      range[0] = next;
+      range[1] = std::min(n, end-next);
+      next += range[1];
+      return range[1] > 0;
+    }
+  };
+
+  // Messages of the farm: requests carry nothing, replies a range {first, count}.
+  // Without MPI they go through the Communicator, whose Send never waits.
+#if USE_MPI
+  static void SendRequest(Communicator &master_comm, int master)
+  {
+    int request = 0;
+    MPI_Send(&request, 1, MPI_INT, master, REQUEST_TAG, master_comm.MPIComm);
+  }
+
+  // Receives a request from any worker, returning the worker
+  static int ReceiveRequest(Communicator &worker_comm)
+  {
+    int request;
+    MPI_Status status;
+    MPI_Recv(&request, 1, MPI_INT, MPI_ANY_SOURCE, REQUEST_TAG, worker_comm.MPIComm, &status);
+    return status.MPI_SOURCE;
+  }
+
+  static void SendRange(Communicator &worker_comm, int worker, int range[2])
+  {
+    MPI_Send(range, 2, MPI_INT, worker, REPLY_TAG, worker_comm.MPIComm);
+  }
+
+  static void ReceiveRange(Communicator &master_comm, int master, int range[2])
+  {
+    MPI_Recv(range, 2, MPI_INT, master, REPLY_TAG, master_comm.MPIComm, MPI_STATUS_IGNORE);
+  }
+#else
+  static void SendRequest(Communicator &master_comm, int master)
+  {
+    int request = 0;
+    master_comm.Send(master, request, REQUEST_TAG);
+  }
+
+  static int ReceiveRequest(Communicator &worker_comm)
+  {
+    int request, worker;
+    worker_comm.Probe(Communicator::ANY_SOURCE, REQUEST_TAG, worker);
+    worker_comm.Receive(worker, request, REQUEST_TAG);
+    return worker;
+  }
+
+  static void SendRange(Communicator &worker_comm, int worker, int range[2])
+  {
+    std::pair<int, int> reply(range[0], range[1]);
+    worker_comm.Send(worker, reply, REPLY_TAG);
+  }
+
+  static void ReceiveRange(Communicator &master_comm, int master, int range[2])
+  {
+    std::pair<int, int> reply;
+    master_comm.Receive(master, reply, REPLY_TAG);
+    range[0] = reply.first;
+    range[1] = reply.second;
+  }
+#endif
+
+  // Blocking request for one range from master
+  static void Request(Communicator &master_comm, int master, int range[2])
+  {
+    SendRequest(master_comm, master);
+    ReceiveRange(master_comm, master, range);
+  }
+
+  /* Answers requests from every other process of worker_comm until each has
+   * been told to stop once per request it keeps in flight (depth)
+   */
+  template<class G>
+  static void Serve(Communicator &worker_comm, int depth, G get_range)
+  {
+    int n_workers = worker_comm.NumProcs()-1;
+    std::vector<int> stops(n_workers+1, 0);
+    int n_stopped = 0;
+    bool exhausted = false;
+    while (n_stopped < n_workers) {
+      int worker = ReceiveRequest(worker_comm);
+      int range[2] = {0, 0};
+      if (stops[worker] == 0 && !exhausted)
+        exhausted = !get_range(range);
+      if (range[1] == 0) {
+        range[0] = 0;
+        if (++stops[worker] == depth)
+          ++n_stopped;
+      }
+      SendRange(worker_comm, worker, range);
+    }
+  }
+
+#if USE_MPI
+
+  // Keeps prefetch+1 requests to process 0 in flight and works through the replies
+  template<class F>
+  int Work(Communicator &master_comm, F &work)
+  {
+    int depth = prefetch+1;
+    std::vector<int> ranges(2*depth);
+    std::vector<MPI_Request> replies(depth);
+    int request = 0;
+    for (int slot=0; slot<depth; ++slot) {
+      MPI_Irecv(&ranges[2*slot], 2, MPI_INT, 0, REPLY_TAG, master_comm.MPIComm, &replies[slot]);
+      MPI_Send(&request, 1, MPI_INT, 0, REQUEST_TAG, master_comm.MPIComm);
+    }
+    int n_done = 0;
+    for (int slot=0; ; slot=(slot+1)%depth) {
+      MPI_Wait(&replies[slot], MPI_STATUS_IGNORE);
+      int first = ranges[2*slot], count = ranges[2*slot+1];
+      if (count == 0)
+        break;
+      for (int task=first; task<first+count; ++task)
+        work(task);
+      n_done += count;
+      MPI_Irecv(&ranges[2*slot], 2, MPI_INT, 0, REPLY_TAG, master_comm.MPIComm, &replies[slot]);
+      MPI_Send(&request, 1, MPI_INT, 0, REQUEST_TAG, master_comm.MPIComm);
+    }
+
+    // Remaining replies are all stops
+    MPI_Waitall(depth, replies.data(), MPI_STATUSES_IGNORE);
+    return n_done;
+  }
+#else
+  // Sends prefetch+1 requests to process 0 up front and works through the replies, which arrive in order
+  template<class F>
+  int Work(Communicator &master_comm, F &work)
+  {
+    int depth = prefetch+1;
+    for (int slot=0; slot<depth; ++slot)
+      SendRequest(master_comm, 0);
+    int n_done = 0;
+    int range[2];
+    while (true) {
+      ReceiveRange(master_comm, 0, range);
+      if (range[1] == 0)
+        break;
+      for (int task=range[0]; task<range[0]+range[1]; ++task)
+        work(task);
+      n_done += range[1];
+      SendRequest(master_comm, 0);
+    }
+
+    // Remaining replies are all stops
+    for (int slot=1; slot<depth; ++slot)
+      ReceiveRange(master_comm, 0, range);
+    return n_done;
+  }
+#endif
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_TASK_FARM_H_
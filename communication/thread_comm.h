@@ -0,0 +1,169 @@
+#ifndef SCAFFOLD_COMMUNICATION_THREAD_COMM_H_
+#define SCAFFOLD_COMMUNICATION_THREAD_COMM_H_
+
+// State behind the thread version of Communicator (built with USE_THREAD_COMM
+// instead of USE_MPI), whose processes are threads of one process started by
+// COMM::Launch, for single-node runs without MPI. Collectives read each
+// other's buffers through shared memory between barriers; point-to-point
+// messages are copied into the receiver's mailbox, so Send never waits and
+// Receive matches by source and tag like MPI.
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <condition_variable>
+#include "serialize.h"
+#include "reduce_op.h"
+
+namespace scaffold { namespace parallel {
+
+// Address and size in bytes of contiguous buffers: values of types with
+// MPITypeTraits (see HasMPIType), matrices, vectors and std::vectors
+template<class T>
+inline void* BufferAddr(T &val) { return &val; }
+template<class T>
+inline size_t BufferBytes(T &val) { return sizeof(T); }
+template<class T>
+inline void* BufferAddr(matrix::mat<T> &val)
+{
+#ifdef USE_ARMADILLO
+  return val.memptr();
+#endif
+#ifdef USE_EIGEN
+  return val.data();
+#endif
+}
+template<class T>
+inline size_t BufferBytes(matrix::mat<T> &val) { return val.size()*sizeof(T); }
+template<class T>
+inline void* BufferAddr(matrix::vec<T> &val)
+{
+#ifdef USE_ARMADILLO
+  return val.memptr();
+#endif
+#ifdef USE_EIGEN
+  return val.data();
+#endif
+}
+template<class T>
+inline size_t BufferBytes(matrix::vec<T> &val) { return val.size()*sizeof(T); }
+template<class T>
+inline void* BufferAddr(std::vector<T> &val) { return val.data(); }
+template<class T>
+inline size_t BufferBytes(std::vector<T> &val) { return val.size()*sizeof(T); }
+
+/// Message waiting in a thread's mailbox
+struct ThreadMessage
+{
+  int source;
+  int tag;
+  std::vector<char> bytes;
+};
+
+/// State shared by the threads of one communicator
+class ThreadWorld
+{
+public:
+  explicit ThreadWorld(int t_n_procs)
+    : n_procs(t_n_procs), ptrs(t_n_procs), aux(t_n_procs), sizes(t_n_procs), worlds(t_n_procs),
+      epochs(t_n_procs, 0), count(0), generation(0), mailboxes(t_n_procs)
+  {}
+
+  int n_procs;
+  std::vector<const void*> ptrs; // Buffers published for collectives
+  std::vector<const void*> aux; // Second buffer (e.g. displacements) published with them
+  std::vector<size_t> sizes; // Sizes published with them
+  std::vector< std::shared_ptr<ThreadWorld> > worlds; // Worlds handed out by their creators in Split and the like
+  std::vector<long> epochs; // Counters of Communicator::NextEpoch
+  std::vector<int> cart_dims; // Cartesian grid, if any (see Communicator::CartCreate)
+  std::vector<int> cart_periods;
+
+  /// Waits until every thread has arrived
+  void Barrier()
+  {
+    unsigned my_generation = generation.load(std::memory_order_acquire);
+    if (count.fetch_add(1, std::memory_order_acq_rel) == n_procs-1) {
+      count.store(0, std::memory_order_relaxed);
+      generation.store(my_generation+1, std::memory_order_release);
+    } else
+      for (int spins=0; generation.load(std::memory_order_acquire) == my_generation; ++spins)
+        if (spins > 1000)
+          std::this_thread::yield();
+  }
+
+  /// Appends a message to to_proc's mailbox
+  void Post(int to_proc, ThreadMessage &message)
+  {
+    Mailbox &mailbox = mailboxes[to_proc];
+    {
+      std::lock_guard<std::mutex> lock(mailbox.mutex);
+      mailbox.messages.push_back(ThreadMessage());
+      mailbox.messages.back().source = message.source;
+      mailbox.messages.back().tag = message.tag;
+      mailbox.messages.back().bytes.swap(message.bytes);
+    }
+    mailbox.arrived.notify_all();
+  }
+
+  /** Finds the earliest message in proc's mailbox from from_proc with tag (negative for any)
+   * @param source Set to the sender
+   * @param message Set to the message and removed from the mailbox, unless null
+   * @param wait Whether to wait for a message instead of returning false
+   * return whether there was a message
+   */
+  bool Find(int proc, int from_proc, int tag, int &source, ThreadMessage *message, bool wait)
+  {
+    Mailbox &mailbox = mailboxes[proc];
+    std::unique_lock<std::mutex> lock(mailbox.mutex);
+    while (true) {
+      for (auto it=mailbox.messages.begin(); it!=mailbox.messages.end(); ++it)
+        if (((from_proc < 0) || (it->source == from_proc)) && ((tag < 0) || (it->tag == tag))) {
+          source = it->source;
+          if (message) {
+            message->source = it->source;
+            message->tag = it->tag;
+            message->bytes.swap(it->bytes);
+            mailbox.messages.erase(it);
+          }
+          return true;
+        }
+      if (!wait)
+        return false;
+      mailbox.arrived.wait(lock);
+    }
+  }
+
+private:
+  std::atomic<int> count; // Arrivals at the barrier
+  std::atomic<unsigned> generation; // Barriers completed
+
+  struct Mailbox
+  {
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::list<ThreadMessage> messages;
+  };
+  std::vector<Mailbox> mailboxes;
+};
+
+/// World and process number of a thread (see COMM::Launch)
+struct ThreadRank
+{
+  std::shared_ptr<ThreadWorld> world;
+  int proc;
+};
+
+/// The calling thread's rank; a thread not started by COMM::Launch is alone in its world
+inline ThreadRank& CurrentThreadRank()
+{
+  static thread_local ThreadRank rank = {std::make_shared<ThreadWorld>(1), 0};
+  return rank;
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_THREAD_COMM_H_
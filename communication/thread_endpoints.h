@@ -0,0 +1,74 @@
+#ifndef SCAFFOLD_COMMUNICATION_THREAD_ENDPOINTS_H_
+#define SCAFFOLD_COMMUNICATION_THREAD_ENDPOINTS_H_
+
+#include <vector>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/// Per-thread endpoints for hybrid MPI+OpenMP codes. Each OpenMP thread
+/// gets its own duplicate of the communicator, so threads can send and
+/// receive concurrently without matching each other's messages. Needs MPI
+/// initialized with COMM::THREAD_MULTIPLE. Threads sharing one
+/// communicator can instead separate their messages with ThreadTag().
+class ThreadEndpoints
+{
+public:
+  /** Duplicates comm once per thread (collective over comm)
+   * @param comm Communicator to duplicate
+   * @param n_threads Number of threads that will communicate
+   */
+  ThreadEndpoints(Communicator &comm, int n_threads=MaxThreads())
+  {
+    if ((COMM::GetThreadLevel() < COMM::THREAD_MULTIPLE) && (comm.MyProc() == 0))
+      std::cerr << "WARNING: ThreadEndpoints used without MPI_THREAD_MULTIPLE support." << std::endl;
+    endpoints.resize(n_threads);
+    for (int thread=0; thread<n_threads; ++thread)
+      comm.Dup(endpoints[thread]);
+  }
+
+  ~ThreadEndpoints()
+  {
+    for (auto &endpoint: endpoints)
+      endpoint.Free();
+  }
+
+  ThreadEndpoints(const ThreadEndpoints&) = delete;
+  ThreadEndpoints& operator=(const ThreadEndpoints&) = delete;
+
+  /// Endpoint of the calling thread
+  inline Communicator& operator()() { return endpoints[ThreadNum()]; }
+
+  /// Endpoint of a given thread
+  inline Communicator& operator[](int thread) { return endpoints[thread]; }
+
+  inline int NumThreads() { return endpoints.size(); }
+
+  static inline int ThreadNum()
+  {
+  #if USE_OPENMP
+    return omp_get_thread_num();
+  #else
+    return 0;
+  #endif
+  }
+
+  static inline int MaxThreads()
+  {
+  #if USE_OPENMP
+    return omp_get_max_threads();
+  #else
+    return 1;
+  #endif
+  }
+
+  /// Message tag unique to the calling thread
+  static inline int ThreadTag(int base_tag=0) { return base_tag + ThreadNum(); }
+
+private:
+  std::vector<Communicator> endpoints;
+};
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_THREAD_ENDPOINTS_H_
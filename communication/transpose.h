@@ -0,0 +1,103 @@
+#ifndef SCAFFOLD_COMMUNICATION_TRANSPOSE_H_
+#define SCAFFOLD_COMMUNICATION_TRANSPOSE_H_
+
+#include <cstring>
+#include <algorithm>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+/** Transposes a rows x cols column-major block into a cols x rows one, in
+ * tiles small enough that source and destination lines both stay in cache
+ * @param src Source block, leading dimension ld_src
+ * @param dst Destination block, leading dimension ld_dst
+ */
+template<class T>
+void TransposeBlock(const T* src, int ld_src, T* dst, int ld_dst, int rows, int cols)
+{
+  const int tile = 32;
+  for (int j0=0; j0<cols; j0+=tile)
+    for (int i0=0; i0<rows; i0+=tile) {
+      int j1 = std::min(j0+tile, cols), i1 = std::min(i0+tile, rows);
+      for (int i=i0; i<i1; ++i)
+        for (int j=j0; j<j1; ++j)
+          dst[j + size_t(ld_dst)*i] = src[i + size_t(ld_src)*j];
+    }
+}
+
+/** Transposes a matrix split over the processes in column blocks (as by
+ * ScatterCols), leaving the transpose split the same way. Each process
+ * transposes the piece bound for every other process while packing, so one
+ * Alltoallv completes the exchange and unpacking is plain column copies.
+ * @param A This process's columns of the n_rows x n_cols matrix
+ * @param AT This process's columns of the n_cols x n_rows transpose (resized)
+ */
+template<class T>
+void DistributedTranspose(Communicator &comm, matrix::mat<T> &A, matrix::mat<T> &AT)
+{
+  int n_procs = comm.NumProcs();
+  int my_proc = comm.MyProc();
+#ifdef USE_ARMADILLO
+  int n_rows = A.n_rows, my_n_cols = A.n_cols;
+  const T* a = A.memptr();
+#endif
+#ifdef USE_EIGEN
+  int n_rows = A.rows(), my_n_cols = A.cols();
+  const T* a = A.data();
+#endif
+  int n_cols = 0;
+  comm.AllSum(my_n_cols, n_cols);
+  int my_first_row, my_n_rows;
+  ColBlock(n_rows, my_proc, n_procs, my_first_row, my_n_rows);
+
+  // Block for proc: its rows of A, transposed
+  std::vector<int> send_counts(n_procs), send_displacements(n_procs), recv_counts(n_procs), recv_displacements(n_procs);
+  int send_total = 0, recv_total = 0;
+  for (int proc=0; proc<n_procs; ++proc) {
+    int first, n;
+    ColBlock(n_rows, proc, n_procs, first, n);
+    send_counts[proc] = my_n_cols*n;
+    send_displacements[proc] = send_total;
+    send_total += send_counts[proc];
+    ColBlock(n_cols, proc, n_procs, first, n);
+    recv_counts[proc] = n*my_n_rows;
+    recv_displacements[proc] = recv_total;
+    recv_total += recv_counts[proc];
+  }
+  matrix::vec<T> send_buff(send_total), recv_buff(recv_total);
+#ifdef USE_ARMADILLO
+  T* send_ptr = send_buff.memptr();
+  const T* recv_ptr = recv_buff.memptr();
+#endif
+#ifdef USE_EIGEN
+  T* send_ptr = send_buff.data();
+  const T* recv_ptr = recv_buff.data();
+#endif
+  for (int proc=0; proc<n_procs; ++proc) {
+    int first, n;
+    ColBlock(n_rows, proc, n_procs, first, n);
+    TransposeBlock(a + first, n_rows, send_ptr + send_displacements[proc], my_n_cols, n, my_n_cols);
+  }
+
+  comm.Alltoallv(send_buff, send_counts.data(), send_displacements.data(),
+                 recv_buff, recv_counts.data(), recv_displacements.data());
+
+  // proc's block holds rows [first, first+n) of every local column of AT
+  AT.set_size(n_cols, my_n_rows);
+#ifdef USE_ARMADILLO
+  T* at = AT.memptr();
+#endif
+#ifdef USE_EIGEN
+  T* at = AT.data();
+#endif
+  for (int proc=0; proc<n_procs; ++proc) {
+    int first, n;
+    ColBlock(n_cols, proc, n_procs, first, n);
+    for (int j=0; j<my_n_rows; ++j)
+      memcpy(at + first + size_t(n_cols)*j, recv_ptr + recv_displacements[proc] + size_t(n)*j, n*sizeof(T));
+  }
+}
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_TRANSPOSE_H_
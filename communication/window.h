@@ -0,0 +1,231 @@
+#ifndef SCAFFOLD_COMMUNICATION_WINDOW_H_
+#define SCAFFOLD_COMMUNICATION_WINDOW_H_
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include "communication.h"
+
+namespace scaffold { namespace parallel {
+
+#if USE_MPI
+/// One-sided (RMA) access to a buffer exposed by every process of a
+/// communicator. Operations use passive-target synchronization, so the
+/// target process takes no part in them: wrap them in Lock/Unlock (or
+/// LockAll/UnlockAll), and results of Get/FetchAndOp are valid after the
+/// next Flush or Unlock. Displacements count elements of the exposed buffer.
+class Window
+{
+public:
+  /** Exposes a buffer (collective over comm)
+   * @param t_comm Processes sharing the window
+   * @param buff Local buffer to expose, which must outlive the window
+   */
+  template<class T>
+  Window(Communicator &t_comm, T &buff)
+    : comm(t_comm)
+  {
+    int disp_unit;
+    MPI_Type_size(MPITypeTraits<T>::GetType(buff), &disp_unit);
+    MPI_Win_create(MPITypeTraits<T>::GetAddr(buff), MPI_Aint(MPITypeTraits<T>::GetSize(buff))*disp_unit, disp_unit, MPI_INFO_NULL, comm.MPIComm, &win);
+  }
+
+  ~Window()
+  {
+    MPI_Win_free(&win);
+  }
+
+  Window(const Window&) = delete;
+  Window& operator=(const Window&) = delete;
+
+  Communicator comm;
+  MPI_Win win;
+
+  // Passive-target epochs
+  inline int Lock(int proc, bool exclusive=false) { return MPI_Win_lock(exclusive ? MPI_LOCK_EXCLUSIVE : MPI_LOCK_SHARED, proc, 0, win); }
+  inline int Unlock(int proc) { return MPI_Win_unlock(proc, win); }
+  inline int LockAll() { return MPI_Win_lock_all(0, win); }
+  inline int UnlockAll() { return MPI_Win_unlock_all(win); }
+  inline int Flush(int proc) { return MPI_Win_flush(proc, win); }
+  inline int FlushAll() { return MPI_Win_flush_all(win); }
+
+  // Put
+  template<class T>
+  inline int Put(int to_proc, MPI_Aint disp, T &val)
+  {
+    return MPI_Put(MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), to_proc, disp, MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), win);
+  }
+
+  // Get
+  template<class T>
+  inline int Get(int from_proc, MPI_Aint disp, T &val)
+  {
+    return MPI_Get(MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), from_proc, disp, MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), win);
+  }
+
+  // Accumulate (element-wise and atomic per element)
+  template<class T>
+  inline int Accumulate(int to_proc, MPI_Aint disp, T &val, MPI_Op Op)
+  {
+    return MPI_Accumulate(MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), to_proc, disp, MPITypeTraits<T>::GetSize(val), MPITypeTraits<T>::GetType(val), Op, win);
+  }
+
+  // AccumulateSum
+  template<class T>
+  inline int AccumulateSum(int to_proc, MPI_Aint disp, T &val) { return Accumulate(to_proc, disp, val, MPI_SUM); }
+
+  // FetchAndOp (single element), result holds the target's previous value
+  template<class T>
+  inline int FetchAndOp(int proc, MPI_Aint disp, T &val, T &result, MPI_Op Op)
+  {
+    return MPI_Fetch_and_op(MPITypeTraits<T>::GetAddr(val), MPITypeTraits<T>::GetAddr(result), MPITypeTraits<T>::GetType(val), proc, disp, Op, win);
+  }
+
+  // FetchAndAdd
+  template<class T>
+  inline int FetchAndAdd(int proc, MPI_Aint disp, T &val, T &result) { return FetchAndOp(proc, disp, val, result, MPI_SUM); }
+
+};
+#else   // Serial and thread versions
+// Elements and element count of a buffer
+template<class T>
+inline T* WindowElems(T &val, size_t &n) { n = 1; return &val; }
+template<class T>
+inline T* WindowElems(matrix::vec<T> &val, size_t &n)
+{
+  n = val.size();
+#ifdef USE_ARMADILLO
+  return val.memptr();
+#endif
+#ifdef USE_EIGEN
+  return val.data();
+#endif
+}
+template<class T>
+inline T* WindowElems(matrix::mat<T> &val, size_t &n)
+{
+  n = val.size();
+#ifdef USE_ARMADILLO
+  return val.memptr();
+#endif
+#ifdef USE_EIGEN
+  return val.data();
+#endif
+}
+
+/// Every process's exposed buffer lives in this process's memory, so
+/// operations act immediately on the target's buffer, each holding the
+/// target window's mutex (so Accumulate and FetchAndOp are atomic); an
+/// exclusive Lock holds it until Unlock. Ops are reduction functors (see
+/// reduce_op.h).
+class Window
+{
+public:
+  template<class T>
+  Window(Communicator &t_comm, T &buff)
+    : comm(t_comm), held(t_comm.NumProcs(), false)
+  {
+    size_t n;
+    base = WindowElems(buff, n);
+    std::vector<Window*> mine(1, this);
+    peers.resize(comm.NumProcs());
+    comm.AllGather(mine, peers);
+  }
+
+  ~Window()
+  {
+    comm.BarrierSync(); // Peers may still access this window until they free theirs
+  }
+
+  Window(const Window&) = delete;
+  Window& operator=(const Window&) = delete;
+
+  Communicator comm;
+
+  inline int Lock(int proc, bool exclusive=false)
+  {
+    if (exclusive && !held[proc]) {
+      peers[proc]->mutex.lock();
+      held[proc] = true;
+    }
+    return 0;
+  }
+
+  inline int Unlock(int proc)
+  {
+    if (held[proc]) {
+      held[proc] = false;
+      peers[proc]->mutex.unlock();
+    }
+    return 0;
+  }
+
+  inline int LockAll() { return 0; }
+  inline int UnlockAll() { return 0; }
+  inline int Flush(int proc) { return 0; }
+  inline int FlushAll() { return 0; }
+
+  template<class T>
+  inline int Put(int to_proc, std::ptrdiff_t disp, T &val)
+  {
+    std::lock_guard<std::recursive_mutex> lock(peers[to_proc]->mutex);
+    size_t n;
+    auto elems = WindowElems(val, n);
+    std::copy(elems, elems+n, Target(to_proc, elems, disp));
+    return 0;
+  }
+
+  template<class T>
+  inline int Get(int from_proc, std::ptrdiff_t disp, T &val)
+  {
+    std::lock_guard<std::recursive_mutex> lock(peers[from_proc]->mutex);
+    size_t n;
+    auto elems = WindowElems(val, n);
+    auto target = Target(from_proc, elems, disp);
+    std::copy(target, target+n, elems);
+    return 0;
+  }
+
+  template<class T, class Op>
+  inline int Accumulate(int to_proc, std::ptrdiff_t disp, T &val, Op op)
+  {
+    std::lock_guard<std::recursive_mutex> lock(peers[to_proc]->mutex);
+    size_t n;
+    auto elems = WindowElems(val, n);
+    auto target = Target(to_proc, elems, disp);
+    for (size_t i=0; i<n; ++i)
+      op(elems[i], target[i]);
+    return 0;
+  }
+
+  template<class T>
+  inline int AccumulateSum(int to_proc, std::ptrdiff_t disp, T &val) { return Accumulate(to_proc, disp, val, Plus<typename ElemType<T>::type>()); }
+
+  template<class T, class Op>
+  inline int FetchAndOp(int proc, std::ptrdiff_t disp, T &val, T &result, Op op)
+  {
+    std::lock_guard<std::recursive_mutex> lock(peers[proc]->mutex);
+    T* target = Target(proc, &val, disp);
+    result = *target;
+    op(val, *target);
+    return 0;
+  }
+
+  template<class T>
+  inline int FetchAndAdd(int proc, std::ptrdiff_t disp, T &val, T &result) { return FetchAndOp(proc, disp, val, result, Plus<T>()); }
+
+private:
+  void* base;
+  std::vector<Window*> peers; // Every process's window
+  std::vector<bool> held; // Processes whose window this process holds exclusively
+  std::recursive_mutex mutex;
+
+  template<class E>
+  inline E* Target(int proc, E* elems, std::ptrdiff_t disp) { return static_cast<E*>(peers[proc]->base) + disp; }
+};
+#endif
+
+}}
+
+#endif // SCAFFOLD_COMMUNICATION_WINDOW_H_
@@ -16,6 +16,7 @@ template<typename T> using vec = arma::Col<T>;
 template<typename T> using mat = arma::Mat<T>;
 template<typename T> using cube = arma::Cube<T>;
 template<typename T> using field = arma::field<T>;
+template<typename T> using mat_view = arma::Mat<T>; // Constructed over external memory (copy_aux_mem = false)
 
 // Initialization
 template<typename T, typename... Params>
@@ -35,6 +36,39 @@ auto mag(T&& val) -> decltype(arma::norm(std::forward<T>(val),2)) { return arma:
 using arma::dot;
 using arma::solve;
 
+// LU factorization with partial pivoting, P*A = L*U, with L (unit diagonal) and U packed into LU
+// and P stored as the row order perm, i.e. (P*A)(i,:) = A(perm(i),:). Calls LAPACK getrf in
+// place, so no dense L, U or P are formed. Returns false if A is singular.
+template<typename T>
+inline bool lu_factor(mat<T> &LU, vec<int> &perm, mat<T> &A)
+{
+  LU = A;
+  arma::blas_int m = LU.n_rows, n = LU.n_cols, info = 0;
+  arma::podarray<arma::blas_int> ipiv(std::min(m,n));
+  arma::lapack::getrf(&m, &n, LU.memptr(), &m, ipiv.memptr(), &info);
+  perm.set_size(m);
+  for (arma::blas_int i=0; i<m; ++i)
+    perm(i) = i;
+  for (arma::blas_int i=0; i<std::min(m,n); ++i)
+    std::swap(perm(i), perm(ipiv[i]-1));
+  return info == 0;
+}
+
+// Solve A*X = B given the packed LU factorization of A, with triangular solves
+// (LAPACK trtrs) straight on LU
+template<typename T>
+inline mat<T> lu_solve(mat<T> &LU, vec<int> &perm, mat<T> &B)
+{
+  mat<T> X(B.n_rows, B.n_cols);
+  for (arma::uword i=0; i<B.n_rows; ++i)
+    X.row(i) = B.row(perm(i));
+  arma::blas_int n = LU.n_rows, n_rhs = X.n_cols, info = 0;
+  char lower = 'L', upper = 'U', no_trans = 'N', unit = 'U', non_unit = 'N';
+  arma::lapack::trtrs(&lower, &no_trans, &unit, &n, &n_rhs, LU.memptr(), &n, X.memptr(), &n, &info);
+  arma::lapack::trtrs(&upper, &no_trans, &non_unit, &n, &n_rhs, LU.memptr(), &n, X.memptr(), &n, &info);
+  return X;
+}
+
 }} // namespace
 
 #endif // SCAFFOLD_MATRIX_ARMADILLO_H_
@@ -2,6 +2,7 @@
 #define SCAFFOLD_MATRIX_EIGEN_H_
 
 #define EIGEN_NO_DEBUG
+#include <cmath>
 #include <eigen3/Eigen/Eigen>
 
 namespace scaffold { namespace matrix {
@@ -9,6 +10,7 @@ namespace scaffold { namespace matrix {
 // Basic types
 template<typename T> using vec = Eigen::Matrix<T, Eigen::Dynamic, 1>;
 template<typename T> using mat = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+template<typename T> using mat_view = Eigen::Map<mat<T>>; // Matrix over external memory
 template<typename T>
 struct cube {
     cube (int _n_rows, int _n_cols, int _n_slices)
@@ -121,6 +123,34 @@ auto dot(T& val1, T& val2) -> decltype(val1.dot(val2)) { return val1.dot(val2);
 template<typename T>
 inline T solve(T &val1, T &val2) { return val1.fullPivLu().solve(val2); }
 
+// LU factorization with partial pivoting, P*A = L*U, with L (unit diagonal) and U packed into LU
+// and P stored as the row order perm, i.e. (P*A)(i,:) = A(perm(i),:). Returns false if A is singular.
+template<typename T>
+inline bool lu_factor(mat<T> &LU, vec<int> &perm, mat<T> &A)
+{
+  Eigen::PartialPivLU<mat<T>> lu(A);
+  LU = lu.matrixLU();
+  perm.resize(A.rows());
+  for (int i=0; i<A.rows(); ++i)
+    perm(lu.permutationP().indices()(i)) = i;
+  for (int i=0; i<LU.rows(); ++i)
+    if ((LU(i,i) == T(0)) || !std::isfinite(std::abs(LU(i,i))))
+      return false; // Singular
+  return true;
+}
+
+// Solve A*X = B given the packed LU factorization of A
+template<typename T>
+inline mat<T> lu_solve(mat<T> &LU, vec<int> &perm, mat<T> &B)
+{
+  mat<T> X(B.rows(), B.cols());
+  for (int i=0; i<B.rows(); ++i)
+    X.row(i) = B.row(perm(i));
+  LU.template triangularView<Eigen::UnitLower>().solveInPlace(X);
+  LU.template triangularView<Eigen::Upper>().solveInPlace(X);
+  return X;
+}
+
 }} // namespace
 
 #endif // SCAFFOLD_MATRIX_EIGEN_H_
@@ -4,6 +4,21 @@
 #include "matrix/matrix.h"
 #include "algorithm/algorithm.h"
 #include "communication/communication.h"
+#include "communication/dist_mat.h"
+#include "communication/linear_solve.h"
+#include "communication/hierarchical.h"
+#include "communication/shared_memory.h"
+#include "communication/window.h"
+#include "communication/thread_endpoints.h"
+#include "communication/task_farm.h"
+#include "communication/load_balance.h"
+#include "communication/halo.h"
+#include "communication/transpose.h"
+#include "communication/sparse_exchange.h"
+#include "communication/comm_tuning.h"
+#include "communication/aggregator.h"
+#include "communication/active_message.h"
+#include "communication/distributed_map.h"
 #include "io/io_xml.h"
 #include "io/io_hdf5.h"
 #include "rng/rng.h"
@@ -0,0 +1,148 @@
+// Latency and bandwidth of Communicator operations over message sizes and
+// communicator sizes, written out as a tuning table (see comm_tuning.h).
+//
+// Usage: mpirun -np N ./scaffold_comm_bench [TuningFile] [MaxBytes]
+
+#include <scaffold.h>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+using namespace scaffold::matrix;
+using namespace scaffold::parallel;
+
+#if USE_MPI
+// Seconds per call of f, the slowest process's
+template<class F>
+double Time(Communicator &comm, int reps, F f)
+{
+  f(); // Warm up
+  comm.BarrierSync();
+  double start = MPI_Wtime();
+  for (int i=0; i<reps; ++i)
+    f();
+  double time = (MPI_Wtime() - start)/reps, max_time;
+  comm.AllReduce(time, max_time, MPI_MAX);
+  return max_time;
+}
+
+// Prints one measurement on process 0 of comm
+void Report(Communicator &comm, const std::string &op, size_t bytes, double time)
+{
+  if (comm.MyProc() == 0)
+    std::cout << std::setw(8) << comm.NumProcs() << std::setw(28) << op << std::setw(12) << bytes
+              << std::setw(14) << std::setprecision(4) << time*1e6
+              << std::setw(14) << std::setprecision(4) << bytes/time/1e6 << std::endl;
+}
+
+// Measures every operation on comm and tunes its settings
+CommTuning Bench(Communicator &comm, size_t max_bytes)
+{
+  int n_procs = comm.NumProcs();
+  int my_proc = comm.MyProc();
+  CommTuning tuning;
+  tuning.n_procs = n_procs;
+  tuning.Apply();
+  std::vector<BroadcastAlgorithm> algos = {BCAST_NATIVE, BCAST_BINOMIAL, BCAST_CHAIN, BCAST_SCATTER_ALLGATHER};
+
+  // Segment size and depth of the chain broadcast, at the largest size
+  size_t max_count = std::max(size_t(1), max_bytes/sizeof(double));
+  vec<double> big = ones<vec<double>>(max_count);
+  double best = -1.;
+  for (size_t segment_size=1<<10; segment_size<=(size_t(1)<<18); segment_size<<=2)
+    for (int depth: {2, 4, 8}) {
+      Communicator::SegmentSize() = segment_size;
+      Communicator::PipelineDepth() = depth;
+      double time = Time(comm, 3, [&]() { comm.Broadcast(0, big, BCAST_CHAIN); });
+      if ((best < 0.) || (time < best)) {
+        best = time;
+        tuning.segment_size = segment_size;
+        tuning.pipeline_depth = depth;
+      }
+    }
+  tuning.Apply();
+
+  for (size_t count=1; count<=max_count; count*=4) {
+    size_t bytes = count*sizeof(double);
+    int reps = std::max(size_t(3), std::min(size_t(200), (size_t(1)<<24)/bytes));
+    vec<double> a = ones<vec<double>>(count), b(count);
+
+    // Ping-pong between processes 0 and 1 (one-way time)
+    double time = Time(comm, reps, [&]() {
+      if (my_proc == 0) {
+        comm.Send(1, a);
+        comm.Receive(1, b);
+      } else if (my_proc == 1) {
+        comm.Receive(0, b);
+        comm.Send(0, a);
+      }
+    });
+    Report(comm, "PingPong", bytes, time/2);
+
+    time = Time(comm, reps, [&]() { comm.SendReceive((my_proc+1)%n_procs, a, (my_proc+n_procs-1)%n_procs, b); });
+    Report(comm, "SendReceive", bytes, time);
+
+    time = Time(comm, reps, [&]() { comm.AllSum(a, b); });
+    Report(comm, "AllSum", bytes, time);
+
+    mat<double> cols = ones<mat<double>>(count, n_procs);
+    time = Time(comm, reps, [&]() { comm.AllGatherCols(cols); });
+    Report(comm, "AllGatherCols", bytes, time);
+
+    // Fastest broadcast, recorded where it changes
+    BroadcastAlgorithm best_algo = BCAST_NATIVE;
+    best = -1.;
+    for (auto algo: algos) {
+      time = Time(comm, reps, [&]() { comm.Broadcast(0, a, algo); });
+      Report(comm, std::string("Broadcast/") + BroadcastAlgorithmName(algo), bytes, time);
+      if ((best < 0.) || (time < best)) {
+        best = time;
+        best_algo = algo;
+      }
+    }
+    if (tuning.broadcast.empty() || (tuning.broadcast.back().second != best_algo))
+      tuning.broadcast.push_back(std::make_pair(tuning.broadcast.empty() ? 0 : bytes, best_algo));
+  }
+  return tuning;
+}
+#endif
+
+int main(int argc, char** argv)
+{
+  COMM::Init(argc, argv);
+  std::string tuning_file = (argc > 1) ? argv[1] : "comm_tuning.xml";
+  size_t max_bytes = (argc > 2) ? std::strtoul(argv[2], 0, 10) : (1<<22);
+
+#if USE_MPI
+  Communicator world_comm;
+  int n_procs = world_comm.NumProcs();
+  int my_proc = world_comm.MyProc();
+  if (my_proc == 0)
+    std::cout << std::setw(8) << "n_procs" << std::setw(28) << "op" << std::setw(12) << "bytes"
+              << std::setw(14) << "time(us)" << std::setw(14) << "MB/s" << std::endl;
+
+  // Groups of 2, 4, ... processes side by side, then all of them
+  std::vector<CommTuning> tunings;
+  for (int group_size=2; group_size<=n_procs; group_size*=2) {
+    if ((group_size == n_procs) || (n_procs % group_size != 0))
+      continue;
+    Communicator group_comm;
+    world_comm.Split(my_proc/group_size, group_comm);
+    tunings.push_back(Bench(group_comm, max_bytes));
+    group_comm.Free();
+  }
+  if (n_procs > 1)
+    tunings.push_back(Bench(world_comm, max_bytes));
+
+  // Group 0's tunings stand for every group of its size
+  if (my_proc == 0) {
+    SaveCommTuning(tuning_file, tunings);
+    std::cout << "Wrote " << tuning_file << std::endl;
+  }
+#else
+  std::cout << "scaffold_comm_bench needs USE_MPI." << std::endl;
+#endif
+
+  COMM::Finalize();
+  return 0;
+}
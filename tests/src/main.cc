@@ -2,21 +2,43 @@
 
 int main(int argc, char** argv)
 {
-  COMM::Init(argc, argv);
+  COMM::Init(argc, argv, COMM::THREAD_MULTIPLE);
 
   // Get input file
   std::string in_file = "";
+#if USE_THREAD_COMM
+  int n_procs = 4;
+  if( argc == 3 )
+    n_procs = atoi(argv[2]);
+  if( (argc == 2) || (argc == 3) )
+    in_file = argv[1];
+  else {
+    std::cout << "Usage: ./test InputFile [NumProcesses]\n";
+    return 1;
+  }
+#else
   if( argc == 2 )
     in_file = argv[1];
   else {
     std::cout << "Usage: ./test InputFile\n";
     return 1;
   }
+#endif
 
+#if USE_THREAD_COMM
+  // Every process is a thread running the whole simulation
+  COMM::Launch(n_procs, [&]() {
+    Simulation sim;
+    sim.SetupIO(in_file);
+    sim.BuildMPIModel();
+    sim.Run();
+  });
+#else
   Simulation sim;
   sim.SetupIO(in_file);
   sim.BuildMPIModel();
   sim.Run();
+#endif
 
   COMM::Finalize();
 
@@ -15,7 +15,7 @@ class Simulation
 {
 public:
   // Constructor
-#if USE_MPI
+#if USE_MPI || USE_THREAD_COMM
   Simulation() : rng((int)time(0)*(COMM::WorldProc()+1)) {}
 #else
   Simulation() : rng((int)time(0)) {}
@@ -46,10 +46,34 @@ public:
   void ReturnSync() { world_comm.BarrierSync(); };
   void TestInverse(Communicator &my_comm);
   void TestAllGatherCols(Communicator &my_comm);
+  void TestAllGatherv(Communicator &my_comm);
   void TestBroadcast(Communicator &my_comm);
   void TestSendReceive(Communicator &my_comm);
   void TestSendrecv(Communicator &my_comm);
   void TestSums(Communicator &my_comm);
+  void TestDistMat(Communicator &my_comm);
+  void TestSolve(Communicator &my_comm);
+  void TestHierarchical(Communicator &my_comm);
+  int CheckHierarchical(Communicator &my_comm, int procs_per_node);
+  void TestSharedMat(Communicator &my_comm);
+  void TestWindow(Communicator &my_comm);
+  void TestThreadEndpoints(Communicator &my_comm);
+  void TestCommProfile(Communicator &my_comm);
+  void TestLargeMessages(Communicator &my_comm);
+  void TestReduceOps(Communicator &my_comm);
+  void TestPipelinedReduce(Communicator &my_comm);
+  void TestTaskFarm(Communicator &my_comm);
+  void TestLoadBalance(Communicator &my_comm);
+  void TestHaloExchange(Communicator &my_comm);
+  void TestTranspose(Communicator &my_comm);
+  void TestScan(Communicator &my_comm);
+  void TestSerialize(Communicator &my_comm);
+  void TestMessageMatching(Communicator &my_comm);
+  void TestSparseExchange(Communicator &my_comm);
+  void TestCommTuning(Communicator &my_comm);
+  void TestMessageAggregator(Communicator &my_comm);
+  void TestActiveMessages(Communicator &my_comm);
+  void TestDistributedMap(Communicator &my_comm);
 
 };
 
@@ -63,7 +87,9 @@ void Simulation::SetupIO(std::string in_file)
   tmp_ss << in.GetChild("IO").GetAttribute<std::string>("output_prefix") << ".h5";
   std::string output = tmp_ss.str();
   out.Load(output);
-  out.Create();
+  if (world_comm.MyProc() == 0)
+    out.Create();
+  world_comm.BarrierSync();
 }
 
 void Simulation::BuildMPIModel()
@@ -134,10 +160,33 @@ void Simulation::MPITests()
   // Run MPI Tests
   TestInverse(intra_comm);
   TestAllGatherCols(intra_comm);
+  TestAllGatherv(intra_comm);
   TestBroadcast(intra_comm);
   TestSendReceive(intra_comm);
   TestSendrecv(intra_comm);
   TestSums(intra_comm);
+  TestDistMat(world_comm);
+  TestSolve(world_comm);
+  TestHierarchical(world_comm);
+  TestSharedMat(world_comm);
+  TestWindow(world_comm);
+  TestThreadEndpoints(intra_comm);
+  TestCommProfile(world_comm);
+  TestLargeMessages(intra_comm);
+  TestReduceOps(world_comm);
+  TestPipelinedReduce(world_comm);
+  TestTaskFarm(world_comm);
+  TestLoadBalance(world_comm);
+  TestHaloExchange(world_comm);
+  TestTranspose(world_comm);
+  TestScan(world_comm);
+  TestSerialize(intra_comm);
+  TestMessageMatching(world_comm);
+  TestSparseExchange(world_comm);
+  TestCommTuning(world_comm);
+  TestMessageAggregator(world_comm);
+  TestActiveMessages(world_comm);
+  TestDistributedMap(world_comm);
 }
 
 void Simulation::TestInverse(Communicator &my_comm)
@@ -197,6 +246,42 @@ void Simulation::TestAllGatherCols(Communicator &my_comm)
   ReturnSync();
 }
 
+void Simulation::TestAllGatherv(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+
+  // Process p contributes p+1 copies of p
+  vec<double> mine = my_proc*ones<vec<double>>(my_proc+1), all;
+  std::vector<int> offsets;
+  my_comm.AllGatherv(mine, all, offsets);
+  int it_worked = (all.size() == n_procs*(n_procs+1)/2) && (offsets[my_proc] == my_proc*(my_proc+1)/2);
+  for (int proc=0; proc<n_procs; ++proc)
+    it_worked &= (all(offsets[proc+1]-1) == proc);
+
+  // Repeated gathers reuse the cached counts
+  GathervCounts counts;
+  std::vector<int> mine_std(my_proc+1, my_proc), all_std;
+  for (int i=0; i<2; ++i) {
+    my_comm.Gatherv(0, mine_std, all_std, counts);
+    my_comm.AllGatherv(mine_std, all_std, counts);
+  }
+  it_worked &= (all_std.size() == all.size()) && (all_std.back() == n_procs-1);
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == my_comm.NumProcs())
+      std::cout << "AllGatherv test ... passed." << std::endl;
+    else {
+      std::cout << "AllGatherv test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
 void Simulation::TestBroadcast(Communicator &my_comm)
 {
   int my_proc = my_comm.MyProc();
@@ -226,6 +311,28 @@ void Simulation::TestBroadcast(Communicator &my_comm)
     }
   }
 
+  // Algorithm test, in several segments from the last process
+  int n_procs = my_comm.NumProcs();
+  size_t segment_size = Communicator::SegmentSize();
+  Communicator::SegmentSize() = 7;
+  int it_worked = 1;
+  for (BroadcastAlgorithm algo: {BCAST_NATIVE, BCAST_BINOMIAL, BCAST_CHAIN, BCAST_SCATTER_ALLGATHER}) {
+    vec<double> v = my_proc*ones<vec<double>>(50+n_procs);
+    my_comm.Broadcast(n_procs-1, v, algo);
+    it_worked &= (sum(v) == (n_procs-1)*(50+n_procs));
+  }
+  Communicator::SegmentSize() = segment_size;
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Broadcast algorithm test ... passed." << std::endl;
+    else {
+      std::cout << "Broadcast algorithm test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
   ReturnSync();
 }
 
@@ -265,6 +372,32 @@ void Simulation::TestSendReceive(Communicator &my_comm)
     }
   }
 
+  // Auto-sized receive test (receivers do not know the sizes)
+  int n_procs = my_comm.NumProcs();
+  if (my_proc == 0) {
+    for (int proc=1; proc<n_procs; ++proc) {
+      mat<double> A = proc*ones<mat<double>>(3,proc+1);
+      vec<int> v = ones<vec<int>>(proc+2);
+      my_comm.Send(proc, A);
+      my_comm.Send(proc, v);
+    }
+  } else {
+    mat<double> A(3,0);
+    vec<int> v;
+    my_comm.ReceiveResize(0, A);
+    my_comm.ReceiveResize(0, v);
+    int it_worked = (A.size() == 3*(my_proc+1)) && (A(2,my_proc) == my_proc) && (sum(A) == 3*my_proc*(my_proc+1))
+                    && (v.size() == my_proc+2) && (sum(v) == my_proc+2);
+    if (my_proc == 1) {
+      if (it_worked)
+        std::cout << "ReceiveResize test ... passed." << std::endl;
+      else {
+        std::cout << "ReceiveResize test ... failed." << std::endl;
+        exit(1);
+      }
+    }
+  }
+
   ReturnSync();
 }
 
@@ -338,5 +471,984 @@ void Simulation::TestSums(Communicator &my_comm)
 }
 
 
+void Simulation::TestDistMat(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int m = 7, k = 5, n = 6;
+
+  // Set up initial matrices
+  mat<double> A = random<mat<double>>(m,k);
+  mat<double> B = random<mat<double>>(k,n);
+  my_comm.Broadcast(0,A);
+  my_comm.Broadcast(0,B);
+
+  // Distribute on a 2D grid if possible
+  ProcessGrid grid(my_comm, (n_procs%2 == 0) ? 2 : 1);
+  DistMat<double> dA(grid,m,k,2,2), dB(grid,k,n,2,3), dC(grid,m,n,2,3);
+  dA.Scatter(0,A);
+  dB.Scatter(0,B);
+
+  // Multiply and move to a 1D layout
+  Multiply(dA,dB,dC);
+  ProcessGrid line(my_comm);
+  DistMat<double> dC1(line,m,n,m,1);
+  dC.Redistribute(dC1);
+
+  // Gather result
+  mat<double> C;
+  dC1.Gather(0,C);
+  if (my_proc == 0) {
+    if (mag(A*B-C) < 1.e-9)
+      std::cout << "DistMat multiply test ... passed." << std::endl;
+    else {
+      std::cout << "DistMat multiply test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+void Simulation::TestSolve(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n = 9;
+
+  // Set up initial matrices (only needed on the root)
+  mat<double> A = random<mat<double>>(n,n) + n*identity<mat<double>>(n,n);
+  mat<double> B = random<mat<double>>(n,3);
+
+  // Solve and invert
+  mat<double> X, AI;
+  int it_worked = Solve(my_comm,0,A,B,X);
+  it_worked &= Inverse(my_comm,0,A,AI);
+
+  // A singular matrix fails to factorize
+  mat<double> S = ones<mat<double>>(n,n);
+  it_worked &= !Solve(my_comm,0,S,B,X);
+
+  // Check on the root, which holds the original A and B
+  X.resize(0,0);
+  Solve(my_comm,0,A,B,X);
+  mat<double> In = identity<mat<double>>(n,n);
+  if (my_proc == 0) {
+    if (it_worked && (mag(A*X-B) < 1.e-9) && (mag(A*AI-In) < 1.e-9))
+      std::cout << "Parallel solve/inverse test ... passed." << std::endl;
+    else {
+      std::cout << "Parallel solve/inverse test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+void Simulation::TestHierarchical(Communicator &my_comm)
+{
+  // Real nodes, then nodes faked from pairs of processes
+  int it_worked = 1;
+  for (int procs_per_node: {0, 2})
+    it_worked &= CheckHierarchical(my_comm, procs_per_node);
+
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Hierarchical collectives test ... passed." << std::endl;
+    else {
+      std::cout << "Hierarchical collectives test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+int Simulation::CheckHierarchical(Communicator &my_comm, int procs_per_node)
+{
+  HierarchicalCommunicator h_comm(my_comm, procs_per_node);
+  int my_proc = h_comm.MyProc();
+  int n_procs = h_comm.NumProcs();
+  int last_proc = n_procs-1;
+  int it_worked = 1;
+  if (procs_per_node > 0)
+    it_worked &= (h_comm.NumNodes() == (n_procs+procs_per_node-1)/procs_per_node);
+
+  // AllSum test
+  mat<int> my_mat = ones<mat<int>>(2,2);
+  mat<int> my_sum = zeros<mat<int>>(2,2);
+  h_comm.AllSum(my_mat, my_sum);
+  it_worked &= (sum(my_sum) == 4*n_procs);
+
+  // Broadcast test from a non-leader
+  int my_value = my_proc;
+  h_comm.Broadcast(last_proc, my_value);
+  it_worked &= (my_value == last_proc);
+
+  // Gather test in process order
+  vec<int> my_vec = my_proc*ones<vec<int>>(2);
+  vec<int> all_vec = zeros<vec<int>>(2*n_procs);
+  h_comm.Gather(last_proc, my_vec, all_vec);
+  if (my_proc == last_proc)
+    for (int proc=0; proc<n_procs; ++proc)
+      it_worked &= (all_vec(2*proc) == proc) && (all_vec(2*proc+1) == proc);
+  return it_worked;
+}
+void Simulation::TestSharedMat(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n = 5;
+
+  // Fill one copy per node
+  Communicator node_comm;
+  my_comm.SplitShared(node_comm);
+  {
+    SharedMat<double> table(node_comm,n,n);
+    if (table.IsOwner())
+      for (int j=0; j<n; ++j)
+        for (int i=0; i<n; ++i)
+          table.Mat()(i,j) = i + n*j;
+    table.Fence();
+
+    // Read from every process
+    int it_worked = 1;
+    for (int j=0; j<n; ++j)
+      for (int i=0; i<n; ++i)
+        it_worked &= (table.Mat()(i,j) == i + n*j);
+    int tot = 0;
+    my_comm.Sum(0, it_worked, tot);
+    if (my_proc == 0) {
+      if (tot == my_comm.NumProcs())
+        std::cout << "SharedMat test ... passed." << std::endl;
+      else {
+        std::cout << "SharedMat test ... failed." << std::endl;
+        exit(1);
+      }
+    }
+  }
+
+  ReturnSync();
+}
+void Simulation::TestWindow(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+
+  // Distributed histogram with one bin per process, plus a shared counter
+  vec<int> hist = zeros<vec<int>>(n_procs);
+  int counter = 0;
+  {
+    Window hist_win(my_comm, hist), counter_win(my_comm, counter);
+    hist_win.LockAll();
+    vec<int> ones_vec = ones<vec<int>>(n_procs);
+    for (int proc=0; proc<n_procs; ++proc)
+      hist_win.AccumulateSum(proc, 0, ones_vec);
+    hist_win.UnlockAll();
+
+    int one = 1, old = -1;
+    counter_win.Lock(0);
+    counter_win.FetchAndAdd(0, 0, one, old);
+    counter_win.Unlock(0);
+    my_comm.BarrierSync();
+
+    // Read a remote bin
+    int remote = -1;
+    int other = (my_proc+1)%n_procs;
+    hist_win.Lock(other);
+    hist_win.Get(other, other, remote);
+    hist_win.Unlock(other);
+
+    int it_worked = (remote == n_procs) && (old >= 0) && (old < n_procs);
+    int tot = 0;
+    my_comm.Sum(0, it_worked, tot);
+    if (my_proc == 0) {
+      if ((tot == n_procs) && (counter == n_procs))
+        std::cout << "Window RMA test ... passed." << std::endl;
+      else {
+        std::cout << "Window RMA test ... failed." << std::endl;
+        exit(1);
+      }
+    }
+  }
+
+  ReturnSync();
+}
+void Simulation::TestThreadEndpoints(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int send_proc = (my_proc+1) % n_procs;
+  int recv_proc = ((my_proc-1) + n_procs) % n_procs;
+
+  // Every thread exchanges with the same thread on neighbouring processes
+  ThreadEndpoints endpoints(my_comm);
+  int it_worked = 1;
+#if USE_OPENMP
+  #pragma omp parallel num_threads(endpoints.NumThreads()) reduction(&:it_worked)
+#endif
+  {
+    int thread = ThreadEndpoints::ThreadNum();
+    int send_val = 1000*my_proc + thread;
+    int recv_val = -1;
+    endpoints().SendReceive(send_proc, send_val, recv_proc, recv_val);
+    it_worked &= (recv_val == 1000*recv_proc + thread);
+  }
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "ThreadEndpoints test ... passed." << std::endl;
+    else {
+      std::cout << "ThreadEndpoints test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+void Simulation::TestCommProfile(Communicator &my_comm)
+{
+#if USE_MPI && USE_COMM_PROFILE
+  int my_proc = my_comm.MyProc();
+
+  // Every process has broadcast at least once by now
+  std::vector<double> sum, min, max;
+  CommProfiler &profiler = CommProfiler::Get();
+  profiler.Aggregate(my_comm.MPIComm, sum, min, max);
+  if (my_proc == 0)
+    out.CreateGroup("CommProfile");
+  profiler.Write(out, "/CommProfile/", my_comm.MPIComm);
+  if (my_proc == 0) {
+    if (min[COMM_BROADCAST*CommProfiler::N_FIELDS + CommProfiler::CALLS] > 0)
+      std::cout << "Communication profile test ... passed." << std::endl;
+    else {
+      std::cout << "Communication profile test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+#endif
+
+  ReturnSync();
+}
+
+void Simulation::TestLargeMessages(Communicator &my_comm)
+{
+#if USE_MPI
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int n_rows = 3;
+  int n_cols = 2*n_procs+1;
+
+  // Force chunking of every buffer bigger than 4 elements
+  size_t max_count = Communicator::MaxCount();
+  Communicator::MaxCount() = 4;
+  int it_worked = 1;
+
+  // Send/Receive
+  mat<double> A = (my_proc+1)*ones<mat<double>>(n_rows,n_cols);
+  if (my_proc == 0)
+    my_comm.Send(1, A);
+  else if (my_proc == 1) {
+    mat<double> B = zeros<mat<double>>(n_rows,n_cols);
+    my_comm.Receive(0, B);
+    it_worked &= (sum(B-ones<mat<double>>(n_rows,n_cols)) == 0);
+  }
+
+  // Broadcast
+  mat<double> C = A;
+  my_comm.Broadcast(0, C);
+  it_worked &= (sum(C-ones<mat<double>>(n_rows,n_cols)) == 0);
+
+  // AllSum
+  mat<double> D = zeros<mat<double>>(n_rows,n_cols);
+  my_comm.AllSum(A, D);
+  it_worked &= (sum(D-(n_procs*(n_procs+1)/2)*ones<mat<double>>(n_rows,n_cols)) == 0);
+
+  // AllGather
+  mat<double> E = zeros<mat<double>>(n_rows,n_procs*n_cols);
+  my_comm.AllGather(A, E);
+  for (int proc=0; proc<n_procs; ++proc)
+    it_worked &= (E(n_rows-1,proc*n_cols+n_cols-1) == proc+1);
+
+  // AllGatherCols
+  mat<double> F = my_proc*ones<mat<double>>(n_rows,n_cols);
+  my_comm.AllGatherCols(F);
+  it_worked &= (F(n_rows-1,n_cols-1) == n_procs-1);
+
+  // Scan and ExScan
+  mat<double> G = zeros<mat<double>>(n_rows,n_cols), H = zeros<mat<double>>(n_rows,n_cols);
+  my_comm.ScanSum(A, G);
+  my_comm.ExScanSum(A, H);
+  it_worked &= (G(n_rows-1,n_cols-1) == (my_proc+1)*(my_proc+2)/2);
+  if (my_proc > 0)
+    it_worked &= (H(n_rows-1,n_cols-1) == my_proc*(my_proc+1)/2);
+
+  // Alltoall, blocks of n_rows*n_cols elements
+  mat<double> I(n_rows,n_procs*n_cols), J(n_rows,n_procs*n_cols);
+  for (int proc=0; proc<n_procs; ++proc)
+    for (int j=0; j<n_cols; ++j)
+      for (int i=0; i<n_rows; ++i)
+        I(i,proc*n_cols+j) = 100*my_proc + proc;
+  my_comm.Alltoall(I, J);
+  for (int proc=0; proc<n_procs; ++proc)
+    it_worked &= (J(n_rows-1,proc*n_cols+n_cols-1) == 100*proc + my_proc);
+
+  Communicator::MaxCount() = max_count;
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Large message test ... passed." << std::endl;
+    else {
+      std::cout << "Large message test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+#endif
+
+  ReturnSync();
+}
+
+void Simulation::TestReduceOps(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int it_worked = 1;
+
+  // MaxLoc
+  ValueLoc<double> my_val, max_val;
+  my_val.value = double(my_proc % 2);
+  my_val.loc = my_proc;
+  my_comm.AllReduce(my_val, max_val, MaxLoc<double>());
+  it_worked &= (max_val.value == 1.) && (max_val.loc == 1);
+
+  // Kahan sum of values too small to register against a large one
+  KahanValue my_sum, tot_sum;
+  if (my_proc == 0)
+    my_sum.Add(1.e16);
+  for (int i=0; i<10; ++i)
+    my_sum.Add(1.);
+  my_comm.AllReduce(my_sum, tot_sum, KahanSum());
+  it_worked &= (tot_sum.Value() == 1.e16 + 10.*n_procs);
+
+  // Moments of 0,...,4*n_procs-1, four values per process
+  Moments my_moments, tot_moments;
+  for (int i=0; i<4; ++i)
+    my_moments.Add(4*my_proc + i);
+  my_comm.AllReduce(my_moments, tot_moments, MomentsMerge());
+  double n = 4.*n_procs;
+  it_worked &= (std::abs(tot_moments.mean - (n-1.)/2.) < 1.e-12);
+  it_worked &= (std::abs(tot_moments.Variance() - n*(n+1.)/12.) < 1.e-10);
+
+  // Histogram edges: just below hi lands in the last bin, NaN nowhere
+  Histogram<3> hist(0., 0.3);
+  hist.Add(std::nextafter(0.3, 0.));
+  hist.Add(std::nan(""));
+  it_worked &= (hist.counts[2] == 1.) && (hist.counts[0] + hist.counts[1] + hist.n_under + hist.n_over == 0.);
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Reduce ops test ... passed." << std::endl;
+    else {
+      std::cout << "Reduce ops test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestPipelinedReduce(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int it_worked = 1;
+
+  // Uneven segments, more of them than the pipeline holds
+  size_t segment_size = Communicator::SegmentSize();
+  Communicator::SegmentSize() = 8;
+  mat<double> A = (my_proc+1)*ones<mat<double>>(10,7);
+  mat<double> B = zeros<mat<double>>(10,7);
+  mat<double> known_sum = (n_procs*(n_procs+1)/2)*ones<mat<double>>(10,7);
+  my_comm.PipelinedAllSum(A, B);
+  it_worked &= (sum(B-known_sum) == 0);
+  mat<double> C = zeros<mat<double>>(10,7);
+  my_comm.PipelinedSum(0, A, C);
+  if (my_proc == 0)
+    it_worked &= (sum(C-known_sum) == 0);
+  Communicator::SegmentSize() = segment_size;
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Pipelined reduce test ... passed." << std::endl;
+    else {
+      std::cout << "Pipelined reduce test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestTaskFarm(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int n_tasks = 37;
+  int it_worked = 1;
+
+  // Every task runs exactly once, with one master and with sub-masters
+  for (int procs_per_master=0; procs_per_master<=2; procs_per_master+=2) {
+    TaskFarm farm(my_comm, 2, 1, procs_per_master);
+    vec<int> my_runs = zeros<vec<int>>(n_tasks);
+    vec<int> runs = zeros<vec<int>>(n_tasks);
+    int n_done = farm.Run(n_tasks, [&](int task) { my_runs(task) += 1; });
+    my_comm.AllSum(my_runs, runs);
+    it_worked &= (n_done == sum(my_runs));
+    for (int task=0; task<n_tasks; ++task)
+      it_worked &= (runs(task) == 1);
+  }
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Task farm test ... passed." << std::endl;
+    else {
+      std::cout << "Task farm test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestLoadBalance(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+
+  // Process p holds 3p+1 walkers of shape 2 x (p+1), then only processes
+  // after the first hold 10, labelled by global index
+  int it_worked = 1;
+  for (int layout=0; layout<2; ++layout) {
+    std::vector<int> counts(n_procs);
+    for (int proc=0; proc<n_procs; ++proc)
+      counts[proc] = (layout == 0) ? 3*proc+1 : 10*(proc > 0);
+    int first = 0, total = 0;
+    for (int proc=0; proc<n_procs; ++proc) {
+      first += (proc < my_proc) ? counts[proc] : 0;
+      total += counts[proc];
+    }
+    std::vector<mat<double>> walkers;
+    for (int i=0; i<counts[my_proc]; ++i)
+      walkers.push_back((first+i)*ones<mat<double>>(2,my_proc+1));
+    int n_moved = LoadBalance(my_comm, walkers);
+
+    // Only surplus walkers move, the kept ones stay in place, none are lost
+    int expected_moved = 0;
+    for (int proc=0; proc<n_procs; ++proc)
+      expected_moved += std::max(0, counts[proc] - (total/n_procs + (proc < total%n_procs)));
+    int target = total/n_procs + (my_proc < total%n_procs);
+    it_worked &= (n_moved == expected_moved) && (walkers.size() == target);
+    int label_sum = 0, all_label_sum = 0;
+    for (int i=0; i<walkers.size(); ++i) {
+      if (i < std::min(target, counts[my_proc]))
+        it_worked &= (walkers[i](1,0) == first+i) && (walkers[i].size() == 2*(my_proc+1));
+      label_sum += walkers[i](0,0);
+    }
+    my_comm.AllSum(label_sum, all_label_sum);
+    it_worked &= (all_label_sum == total*(total-1)/2);
+  }
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Load balance test ... passed." << std::endl;
+    else {
+      std::cout << "Load balance test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestHaloExchange(Communicator &my_comm)
+{
+  int n_procs = my_comm.NumProcs();
+
+  // Periodic 2D grid, each process holding a 3 x 4 block plus a halo of 1
+  std::vector<int> dims = {0, 0}, periods = {1, 1};
+  Communicator cart_comm;
+  my_comm.CartCreate(dims, periods, cart_comm);
+  int my_proc = cart_comm.MyProc();
+  std::vector<int> coords;
+  cart_comm.CartCoords(my_proc, coords);
+  int n_rows = 3, n_cols = 4;
+  int global_rows = dims[0]*n_rows, global_cols = dims[1]*n_cols;
+  mat<double> A = zeros<mat<double>>(n_rows+2,n_cols+2);
+  for (int i=1; i<=n_rows; ++i)
+    for (int j=1; j<=n_cols; ++j)
+      A(i,j) = 1000*(coords[0]*n_rows+i-1) + coords[1]*n_cols+j-1;
+  ExchangeHalos(cart_comm, A, 1, true);
+
+  // Every cell, halo and corners included, holds its wrapped global label
+  int it_worked = 1;
+  for (int i=0; i<n_rows+2; ++i)
+    for (int j=0; j<n_cols+2; ++j) {
+      int gi = (coords[0]*n_rows+i-1+global_rows) % global_rows;
+      int gj = (coords[1]*n_cols+j-1+global_cols) % global_cols;
+      it_worked &= (A(i,j) == 1000*gi + gj);
+    }
+  cart_comm.Free();
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_comm.MyProc() == 0) {
+    if (tot == n_procs)
+      std::cout << "Halo exchange test ... passed." << std::endl;
+    else {
+      std::cout << "Halo exchange test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestTranspose(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int it_worked = 1;
+
+  // Alltoall
+  vec<int> from(n_procs), to(n_procs);
+  for (int proc=0; proc<n_procs; ++proc)
+    from(proc) = 100*my_proc + proc;
+  my_comm.Alltoall(from, to);
+  for (int proc=0; proc<n_procs; ++proc)
+    it_worked &= (to(proc) == 100*proc + my_proc);
+
+  // 37 x 45 matrix in column blocks, big enough for several tiles
+  int n_rows = 37, n_cols = 45;
+  int first_col, my_n_cols, first_row, my_n_rows;
+  ColBlock(n_cols, my_proc, n_procs, first_col, my_n_cols);
+  ColBlock(n_rows, my_proc, n_procs, first_row, my_n_rows);
+  mat<double> A(n_rows, my_n_cols), AT;
+  for (int j=0; j<my_n_cols; ++j)
+    for (int i=0; i<n_rows; ++i)
+      A(i,j) = 1000*i + first_col+j;
+  DistributedTranspose(my_comm, A, AT);
+  for (int j=0; j<my_n_rows; ++j)
+    for (int i=0; i<n_cols; ++i)
+      it_worked &= (AT(i,j) == 1000*(first_row+j) + i);
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Distributed transpose test ... passed." << std::endl;
+    else {
+      std::cout << "Distributed transpose test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestScan(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int it_worked = 1;
+
+  // ScanSum of mat<int>
+  mat<int> my_mat = (my_proc+1)*ones<mat<int>>(2,2);
+  mat<int> scan_mat = zeros<mat<int>>(2,2);
+  my_comm.ScanSum(my_mat, scan_mat);
+  it_worked &= (sum(scan_mat-((my_proc+1)*(my_proc+2)/2)*ones<mat<int>>(2,2)) == 0);
+
+  // ExScanSum
+  int my_value = my_proc+1;
+  int ex_value = 0;
+  my_comm.ExScanSum(my_value, ex_value);
+  if (my_proc > 0)
+    it_worked &= (ex_value == my_proc*(my_proc+1)/2);
+
+  // GlobalOffset
+  long offset = -1, total = -1;
+  my_comm.GlobalOffset(long(my_proc+1), offset, total);
+  it_worked &= (offset == my_proc*(my_proc+1)/2) && (total == n_procs*(n_procs+1)/2);
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Scan test ... passed." << std::endl;
+    else {
+      std::cout << "Scan test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestSerialize(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int it_worked = 1;
+
+  // io::Node tree from process 0 to process 1
+  if (my_proc == 0) {
+    Node node = in.node;
+    my_comm.Send(1, node);
+  } else if (my_proc == 1) {
+    Node node;
+    my_comm.Receive(0, node);
+    Input received(node, in.buffer);
+    it_worked &= (received.GetString() == in.GetString());
+  }
+
+  // std::map and std::vector<std::string> broadcasts
+  std::map<std::string,std::string> attributes;
+  std::vector<std::string> words;
+  if (my_proc == 0) {
+    attributes = in.GetChild("Parallel").node.attributes;
+    words = {"walker", "", "group"};
+  }
+  my_comm.Broadcast(0, attributes);
+  my_comm.Broadcast(0, words);
+  it_worked &= (attributes == in.GetChild("Parallel").node.attributes);
+  it_worked &= (words.size() == 3) && (words[0] == "walker") && (words[1] == "") && (words[2] == "group");
+
+  // field of matrices of different shapes
+  field<mat<double>> mats(3);
+  for (int i=0; i<3; ++i)
+    mats(i) = (my_proc+1)*ones<mat<double>>(i+1,2);
+  my_comm.Broadcast(0, mats);
+  for (int i=0; i<3; ++i)
+    it_worked &= (sum(mats(i)-ones<mat<double>>(i+1,2)) == 0);
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Serialization test ... passed." << std::endl;
+    else {
+      std::cout << "Serialization test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestMessageMatching(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+  int it_worked = 1;
+
+  // Messages from anywhere, received in the order they are probed
+  if (my_proc == 0) {
+    std::vector<int> seen(n_procs, 0);
+    seen[0] = 1;
+    for (int i=1; i<n_procs; ++i) {
+      int source, val;
+      my_comm.Probe(Communicator::ANY_SOURCE, 3, source);
+      my_comm.Receive(source, val, 3);
+      it_worked &= (val == 10*source) && !seen[source];
+      seen[source] = 1;
+    }
+  } else {
+    int val = 10*my_proc;
+    my_comm.Send(0, val, 3);
+  }
+
+#if USE_THREAD_COMM
+  // Sends return at once, so messages can be received out of tag order
+  int send_proc = (my_proc+1) % n_procs;
+  int recv_proc = (my_proc+n_procs-1) % n_procs;
+  std::string first = "first", second = "second", got_first, got_second;
+  my_comm.Send(send_proc, first, 1);
+  my_comm.Send(send_proc, second, 2);
+  my_comm.Receive(recv_proc, got_second, 2);
+  my_comm.Receive(recv_proc, got_first, 1);
+  it_worked &= (got_first == first) && (got_second == second);
+  int source;
+  it_worked &= !my_comm.IProbe(Communicator::ANY_SOURCE, Communicator::ANY_TAG, source);
+#endif
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == n_procs)
+      std::cout << "Message matching test ... passed." << std::endl;
+    else {
+      std::cout << "Message matching test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestSparseExchange(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+
+  // Each process sends proc+1 copies of its number to the next process and
+  // to the one three ahead, which do not know to expect them
+  SparseMessages< vec<int> > sends, recvs;
+  for (int step: {1, 3})
+    sends.push_back(std::make_pair((my_proc+step) % n_procs, my_proc*ones<vec<int>>(my_proc+1)));
+  SparseExchange(my_comm, sends, recvs);
+  int it_worked = (recvs.size() == 2);
+  for (auto &recv: recvs) {
+    int from_proc = recv.first;
+    it_worked &= (recv.second.size() == from_proc+1) && (sum(recv.second) == from_proc*(from_proc+1));
+    it_worked &= (from_proc == (my_proc+n_procs-1) % n_procs) || (from_proc == (my_proc+n_procs-3) % n_procs);
+  }
+
+  // Back-to-back exchanges with no synchronization between them, each round
+  // sending to a different process with a payload that names the round
+  for (int round=0; round<6; ++round) {
+    int step = 1 + round % std::max(1, n_procs-1);
+    SparseMessages< vec<int> > round_sends, round_recvs;
+    round_sends.push_back(std::make_pair((my_proc+step) % n_procs, (100*round+my_proc)*ones<vec<int>>(round+1)));
+    if (my_proc == round % n_procs)
+      round_sends.push_back(std::make_pair(0, (100*round+my_proc)*ones<vec<int>>(round+1)));
+    SparseExchange(my_comm, round_sends, round_recvs);
+    int n_expected = 1 + (my_proc == 0);
+    it_worked &= (round_recvs.size() == n_expected);
+    for (auto &recv: round_recvs)
+      it_worked &= (recv.second.size() == round+1) && (recv.second(0) == 100*round+recv.first);
+  }
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == my_comm.NumProcs())
+      std::cout << "SparseExchange test ... passed." << std::endl;
+    else {
+      std::cout << "SparseExchange test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestCommTuning(Communicator &my_comm)
+{
+  int n_procs = my_comm.NumProcs();
+  std::string filename = "test_comm_tuning.xml";
+
+  // Tunings for 1 and n_procs+1 processes; only the first fits
+  std::vector<CommTuning> tunings(2);
+  tunings[0].segment_size = 1<<12;
+  tunings[0].broadcast = {{0, BCAST_NATIVE}, {1<<16, BCAST_CHAIN}};
+  tunings[1].n_procs = n_procs+1;
+  if (my_comm.MyProc() == 0)
+    SaveCommTuning(filename, tunings);
+  my_comm.BarrierSync();
+
+  size_t segment_size = Communicator::SegmentSize();
+  int it_worked = LoadCommTuning(my_comm, filename) && !LoadCommTuning(my_comm, "missing.xml");
+  it_worked &= (Communicator::SegmentSize() == 1<<12) && (Communicator::BroadcastTable().size() == 2);
+  it_worked &= (Communicator::BroadcastTable()[1].first == 1<<16) && (Communicator::BroadcastTable()[1].second == BCAST_CHAIN);
+  vec<double> v = my_comm.MyProc()*ones<vec<double>>(1<<14);
+  my_comm.Broadcast(0, v);
+  it_worked &= (sum(v) == 0);
+  Communicator::SegmentSize() = segment_size;
+  Communicator::BroadcastTable().clear();
+
+  // The same table through the startup hook COMM::Init runs
+#if USE_THREAD_COMM
+  bool sets_env = (my_comm.MyProc() == 0); // Threads share the environment
+#else
+  bool sets_env = true;
+#endif
+  if (sets_env)
+    setenv("SCAFFOLD_COMM_TUNING", filename.c_str(), 1);
+  my_comm.BarrierSync();
+  it_worked &= (COMM::TuningHook() != nullptr);
+  COMM::RunTuningHook();
+  it_worked &= (Communicator::SegmentSize() == 1<<12) && (Communicator::BroadcastTable().size() == 2);
+  my_comm.BarrierSync();
+  if (sets_env)
+    unsetenv("SCAFFOLD_COMM_TUNING");
+  my_comm.BarrierSync();
+  it_worked &= !LoadCommTuningFromEnv();
+  Communicator::SegmentSize() = segment_size;
+  Communicator::BroadcastTable().clear();
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_comm.MyProc() == 0) {
+    if (tot == my_comm.NumProcs())
+      std::cout << "CommTuning test ... passed." << std::endl;
+    else {
+      std::cout << "CommTuning test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestMessageAggregator(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+
+  // Two steps of 1000 ints from every process to every process, in batches of 64
+  MessageAggregator<int> aggregator(my_comm, 64*sizeof(int));
+  int it_worked = 1;
+  for (int step=0; step<2; ++step) {
+    std::vector<long> sums(n_procs, 0);
+    std::vector<int> counts(n_procs, 0);
+    auto handler = [&](int from_proc, std::vector<int> &batch) {
+      for (int val: batch)
+        sums[from_proc] += val;
+      counts[from_proc] += batch.size();
+    };
+    int from_proc;
+    std::vector<int> batch;
+    for (int i=0; i<1000; ++i) {
+      for (int proc=0; proc<n_procs; ++proc)
+        aggregator.Push(proc, step + i);
+      if (aggregator.Poll(from_proc, batch))
+        handler(from_proc, batch);
+    }
+    aggregator.Finish(handler);
+    for (int proc=0; proc<n_procs; ++proc)
+      it_worked &= (counts[proc] == 1000) && (sums[proc] == 1000*step + 999*1000/2);
+  }
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == my_comm.NumProcs())
+      std::cout << "MessageAggregator test ... passed." << std::endl;
+    else {
+      std::cout << "MessageAggregator test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestActiveMessages(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+
+  // Histogram of 100 bins, bin k owned by process k % n_procs; every
+  // increment is acknowledged by a call back to its sender
+  std::vector<int> bins(100, 0);
+  int n_acks = 0;
+  ActiveMessages am(my_comm, 256);
+  int ack = am.Register<int>([&](int from_proc, int &k) { ++n_acks; });
+  int increment = am.Register<int>([&](int from_proc, int &k) {
+    ++bins[k];
+    am.Call(from_proc, ack, k);
+  });
+
+  // Driven by explicit progress, then by the polling thread
+  int it_worked = 1;
+  for (int pass=0; pass<2; ++pass) {
+    if (pass == 1)
+      am.StartProgressThread();
+    for (int k=0; k<100; ++k) {
+      am.Call(k % n_procs, increment, k);
+      if (pass == 0)
+        am.Progress();
+    }
+    am.Quiesce();
+    am.StopProgressThread();
+    it_worked &= (n_acks == 100*(pass+1));
+    for (int k=my_proc; k<100; k+=n_procs)
+      it_worked &= (bins[k] == n_procs*(pass+1));
+    my_comm.BarrierSync(); // Before anyone calls again
+  }
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == my_comm.NumProcs())
+      std::cout << "ActiveMessages test ... passed." << std::endl;
+    else {
+      std::cout << "ActiveMessages test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
+
+void Simulation::TestDistributedMap(Communicator &my_comm)
+{
+  int my_proc = my_comm.MyProc();
+  int n_procs = my_comm.NumProcs();
+
+  // Each process inserts 10 matrices, of shapes varying with their keys
+  DistributedMap< int, mat<double> > map(my_comm, true);
+  std::vector< std::pair< int, mat<double> > > entries;
+  for (int i=0; i<10; ++i) {
+    int key = 10*my_proc + i;
+    entries.push_back(std::make_pair(key, key*ones<mat<double>>(2,1+key%3)));
+  }
+  map.Insert(entries);
+  int it_worked = (map.Size() == 10*n_procs);
+
+  // Every process looks up every key and one missing key, twice (the second from cache)
+  std::vector<int> keys;
+  for (int key=0; key<=10*n_procs; ++key)
+    keys.push_back(key);
+  for (int pass=0; pass<2; ++pass) {
+    std::vector< mat<double> > vals;
+    std::vector<int> found;
+    map.Lookup(keys, vals, found);
+    for (int key=0; key<10*n_procs; ++key)
+      it_worked &= found[key] && (vals[key].size() == 2*(1+key%3)) && (sum(vals[key]) == key*vals[key].size());
+    it_worked &= !found[10*n_procs];
+  }
+
+  // Every process overwrites key 0 (cached elsewhere); the highest process's value stays
+  entries.assign(1, std::make_pair(0, my_proc*ones<mat<double>>(1,1)));
+  map.Insert(entries);
+  std::vector< mat<double> > vals;
+  std::vector<int> found;
+  keys.assign(1, 0);
+  map.Lookup(keys, vals, found);
+  it_worked &= found[0] && (vals[0](0,0) == n_procs-1);
+
+  int tot = 0;
+  my_comm.Sum(0, it_worked, tot);
+  if (my_proc == 0) {
+    if (tot == my_comm.NumProcs())
+      std::cout << "DistributedMap test ... passed." << std::endl;
+    else {
+      std::cout << "DistributedMap test ... failed." << std::endl;
+      exit(1);
+    }
+  }
+
+  ReturnSync();
+}
 
 #endif